@@ -0,0 +1,219 @@
+/*
+ * Measure loader startup across synthetic image sizes: for each of
+ * QMAGIC and ZMAGIC, and each size class below, generate an image with
+ * mkaout (whose entry point just calls _exit(0)), launch it repeatedly
+ * through the loader, and report best and median wall-clock latency,
+ * median minor page faults, and peak RSS as seen by wait4(). Formats
+ * whose load address is below vm.mmap_min_addr are skipped.
+ * License: GPLv2
+ *
+ * Usage: aout-bench [-n RUNS] [-g MKAOUT] [-- LOADER [ARG...]]
+ *
+ * The loader defaults to ./aout; give e.g. "-- ./aout --native" to
+ * compare loader modes.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "aout.h"
+
+struct size_class {
+	const char *name;
+	const char *text, *data, *bss;
+};
+
+static const struct size_class sizes[] = {
+	{ "tiny",	"4k",	"4k",	"4k" },
+	{ "small",	"64k",	"64k",	"256k" },
+	{ "medium",	"1m",	"1m",	"4m" },
+	{ "large",	"16m",	"8m",	"64m" },
+};
+
+struct format {
+	const char *name;
+	const char *flag;	/* for mkaout */
+	unsigned long load_addr;
+};
+
+static const struct format formats[] = {
+	{ "QMAGIC",	NULL,	Q_MAGIC_LOAD_ADDR },
+	{ "ZMAGIC",	"-z",	Z_MAGIC_LOAD_ADDR },
+};
+
+struct sample {
+	double ms;
+	long minflt;
+	long maxrss;
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-n RUNS] [-g MKAOUT] [-- LOADER [ARG...]]\n", argv0);
+	exit(2);
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/* Run a command to completion, collecting its timing and rusage. */
+static int run(char *cmd[], struct sample *sample)
+{
+	struct rusage ru;
+	double start;
+	int status;
+	pid_t pid;
+
+	start = now_ms();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		execvp(cmd[0], cmd);
+		perror(cmd[0]);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return -1;
+	}
+	if (sample) {
+		sample->ms = now_ms() - start;
+		sample->minflt = ru.ru_minflt;
+		sample->maxrss = ru.ru_maxrss;
+	}
+	return status;
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+	const struct sample *left = a, *right = b;
+
+	return left->ms < right->ms ? -1 : left->ms > right->ms;
+}
+
+static int compare_minflt(const void *a, const void *b)
+{
+	const struct sample *left = a, *right = b;
+
+	return left->minflt < right->minflt ? -1 : left->minflt > right->minflt;
+}
+
+int main(int argc, char *argv[])
+{
+	static char *default_loader[] = { "./aout", NULL };
+	char **loader = default_loader;
+	const char *mkaout = "./mkaout";
+	char dir[] = "/tmp/aout-bench.XXXXXX";
+	struct sample *samples;
+	int runs = 20, nloader;
+	int opt, f, s, i;
+
+	while ((opt = getopt(argc, argv, "n:g:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			if (runs < 1)
+				usage(argv[0]);
+			break;
+		case 'g':
+			mkaout = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc)
+		loader = &argv[optind];
+	for (nloader = 0; loader[nloader]; nloader++)
+		;
+
+	samples = calloc(runs, sizeof(*samples));
+	if (!samples || !mkdtemp(dir)) {
+		perror("setup");
+		return 1;
+	}
+
+	printf("# %-6s %-6s %5s %5s %5s %9s %9s %8s %10s\n", "format", "size",
+	       "text", "data", "bss", "best-ms", "median-ms", "minflt", "maxrss-KiB");
+	for (f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+		const struct format *fmt = &formats[f];
+
+		if (check_mmap_min_addr(fmt->load_addr, fmt->name) < 0) {
+			printf("# %s: skipped, load address %#lx is not mappable\n",
+			       fmt->name, fmt->load_addr);
+			continue;
+		}
+
+		for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+			const struct size_class *size = &sizes[s];
+			char image[sizeof(dir) + 32], status[32] = "";
+			char *gen[] = { (char *)mkaout, "-t", (char *)size->text,
+					"-d", (char *)size->data, "-b", (char *)size->bss,
+					NULL, NULL, NULL };
+			char **cmd;
+			long maxrss = 0;
+			int ret, n = 7;
+
+			snprintf(image, sizeof(image), "%s/%s-%s", dir, fmt->name, size->name);
+			if (fmt->flag)
+				gen[n++] = (char *)fmt->flag;
+			gen[n] = image;
+			ret = run(gen, NULL);
+			if (ret != 0) {
+				fprintf(stderr, "%s: failed to generate %s\n", mkaout, image);
+				return 1;
+			}
+
+			cmd = calloc(nloader + 2, sizeof(*cmd));
+			if (!cmd) {
+				perror("calloc");
+				return 1;
+			}
+			memcpy(cmd, loader, nloader * sizeof(*cmd));
+			cmd[nloader] = image;
+
+			for (i = 0; i < runs; i++) {
+				ret = run(cmd, &samples[i]);
+				if (ret == -1 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+					if (ret != -1 && WIFSIGNALED(ret))
+						snprintf(status, sizeof(status), "signal(%d)", WTERMSIG(ret));
+					else
+						snprintf(status, sizeof(status), "failed(%d)",
+							 ret == -1 ? -1 : WEXITSTATUS(ret));
+					break;
+				}
+				if (samples[i].maxrss > maxrss)
+					maxrss = samples[i].maxrss;
+			}
+			free(cmd);
+			unlink(image);
+
+			printf("  %-6s %-6s %5s %5s %5s ", fmt->name, size->name,
+			       size->text, size->data, size->bss);
+			if (status[0]) {
+				printf("%s\n", status);
+				continue;
+			}
+			qsort(samples, runs, sizeof(*samples), compare_ms);
+			printf("%9.3f %9.3f ", samples[0].ms, samples[runs / 2].ms);
+			qsort(samples, runs, sizeof(*samples), compare_minflt);
+			printf("%8ld %10ld\n", samples[runs / 2].minflt, maxrss);
+		}
+	}
+	rmdir(dir);
+
+	return 0;
+}
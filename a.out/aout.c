@@ -7,6 +7,12 @@
  * For a more complete solution, see also:
  * https://github.com/siegfriedpammer/run-aout
  */
+#define _GNU_SOURCE
+#include <elf.h>
+#include <getopt.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,234 +25,1698 @@
 #include <string.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <ucontext.h>
+#include <sys/prctl.h>
+#include <sys/ptrace.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
 
-/* Locally define the stuff from a.out.h since that file may disappear. */
-struct a_out
-{
-	unsigned int a_info;	/* machine type, magic, etc */
-	unsigned int a_text;	/* text size */
-	unsigned int a_data;	/* data size */
-	unsigned int a_bss;	/* desired bss size */
-	unsigned int a_syms;	/* symbol table size */
-	unsigned int a_entry;	/* entry address */
-	unsigned int a_trsize;	/* text relocation size */
-	unsigned int a_drsize;	/* data relocation size */
-};
-
-#define Q_MAGIC_MAGIC		(0x006400ccUL)
-#define Q_MAGIC_TXT_FDOFF	0x0000
-#define Q_MAGIC_LOAD_ADDR	0x1000
-
-#define Z_MAGIC_MAGIC		(0x0064010bUL)
-#define Z_MAGIC_TXT_FDOFF	0x0400
-#define Z_MAGIC_LOAD_ADDR	0x0000
-
-#define MMAP_MIN_ADDR_PATH	"/proc/sys/vm/mmap_min_addr"
-
-#define ALIGN(x, a)		ALIGN_MASK(x, (unsigned long)(a) - 1)
-#define ALIGN_MASK(x, mask)	(typeof(x))(((unsigned long)(x) + (mask)) & ~(mask))
-
-static void check_mmap_min_addr(unsigned long load_addr, const char *name)
-{
-	unsigned long addr;
-	char buf[128], *result;
-	FILE *proc;
+#include "aout.h"
 
-	proc = fopen(MMAP_MIN_ADDR_PATH, "r");
-	if (!proc)
-		return;
-	result = fgets(buf, sizeof(buf), proc);
-	fclose(proc);
-	if (!result)
-		return;
-
-	addr = strtoul(result, NULL, 0);
-	if (addr <= load_addr)
-		return;
-
-	fprintf(stderr, "%s is set to %lu but this %s a.out binary must be mapped at %lu.\n",
-		MMAP_MIN_ADDR_PATH, addr, name, load_addr);
-	fprintf(stderr, "To temporarily change this, run: sudo sysctl -w vm.mmap_min_addr=%lu\n",
-		load_addr);
-}
+struct aout_image {
+	struct a_out hdr;
+	const char *name;
+	const char *file_type;
+	unsigned long load_addr;
+	unsigned int txtoff;
+	off_t file_size;
+};
 
-int main(int argc, char *argv[], char *envp[])
+/*
+ * Read and validate the a.out header, and work out the file layout. A
+ * symbol table is only accepted when the caller is going to use it.
+ */
+static int parse_aout(int fd, const char *name, struct aout_image *image,
+		      int allow_syms)
 {
-	void *disk_image;
-	struct a_out aout_local;
-	struct a_out *aout;
+	struct a_out *aout = &image->hdr;
 	struct stat info;
-	unsigned char *image, *image_end, *bss, *bss_end, *stack, *stack_end;
-	char **p;
-	unsigned long *sp;
-	struct rlimit rlim;
-	int pagesize;
-	int fd;
-	int argc_copy, envc_copy;
-	unsigned int txtoff;
-	unsigned long load_addr;
-	const char *file_type;
-	char **argv_copy, **envp_copy;
-	size_t image_bytes;
-
-	if (sizeof(void *) != 4) {
-		fprintf(stderr, "Eek: I was compiled in 64-bit mode. Please build with -m32.\n");
-		return 1;
-	}
-
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s a.out [arg ...]\n", argv[0]);
-		return 1;
-	}
-
-	fd = open(argv[1], O_RDONLY);
-	if (fd < 0) {
-		perror(argv[1]);
-		return 1;
-	}
+	ssize_t got;
 
 	if (fstat(fd, &info) < 0) {
-		perror(argv[1]);
-		return 1;
+		perror(name);
+		return -1;
 	}
 
-	if (info.st_size < sizeof(*aout)) {
-		fprintf(stderr, "%s: too small to read a.out header\n", argv[1]);
-		return 1;
+	got = pread(fd, aout, sizeof(*aout), 0);
+	if (got < 0) {
+		perror(name);
+		return -1;
 	}
-
-	aout = disk_image = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-	if (aout == MAP_FAILED) {
-		perror("mmap");
-		return 1;
+	if (got < sizeof(*aout)) {
+		fprintf(stderr, "%s: too small to read a.out header\n", name);
+		return -1;
 	}
 
-	/* Make a copy of the a.out header. */
-	aout_local = *aout;
-	aout = &aout_local;
+	image->name = name;
+	image->file_size = info.st_size;
 
 	switch (aout->a_info) {
 	case Q_MAGIC_MAGIC:
-		load_addr = Q_MAGIC_LOAD_ADDR;
-		txtoff = Q_MAGIC_TXT_FDOFF;
-		file_type = "QMAGIC";
+		image->load_addr = Q_MAGIC_LOAD_ADDR;
+		image->txtoff = Q_MAGIC_TXT_FDOFF;
+		image->file_type = "QMAGIC";
 		break;
 	case Z_MAGIC_MAGIC:
-		load_addr = Z_MAGIC_LOAD_ADDR;
-		txtoff = Z_MAGIC_TXT_FDOFF;
-		file_type = "ZMAGIC";
+		image->load_addr = Z_MAGIC_LOAD_ADDR;
+		image->txtoff = Z_MAGIC_TXT_FDOFF;
+		image->file_type = "ZMAGIC";
 		break;
 	default:
 		fprintf(stderr, "%s: not ia32 QMAGIC or ZMAGIC a.out binary (header 0x%x != 0x%lx or 0x%lx)\n",
-			argv[1], aout->a_info, Q_MAGIC_MAGIC, Z_MAGIC_MAGIC);
-		return 1;
+			name, aout->a_info, Q_MAGIC_MAGIC, Z_MAGIC_MAGIC);
+		return -1;
 	}
 
-	pagesize = getpagesize();
+	if (aout->a_syms != 0 && !allow_syms) {
+		fprintf(stderr, "%s: a.out header a_syms must be 0.\n", name);
+		return -1;
+	}
 
-	/* How many bytes do we want from disk? */
-	image_bytes = info.st_size - txtoff;
+	if (aout->a_trsize != 0) {
+		fprintf(stderr, "%s: a.out header a_trsize must be 0.\n", name);
+		return -1;
+	}
 
-	/* Create region to hold final executable image. */
-	image = mmap((void *)load_addr, image_bytes,
-		     PROT_EXEC | PROT_READ | PROT_WRITE,
-		     MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (image == MAP_FAILED) {
-		perror("mmap");
-		check_mmap_min_addr(load_addr, file_type);
-		return 1;
+	if (aout->a_drsize != 0) {
+		fprintf(stderr, "%s: a.out header a_drsize must be 0.\n", name);
+		return -1;
 	}
-	memcpy(image, disk_image + txtoff, image_bytes);
-	if (munmap(disk_image, info.st_size) < 0) {
-		perror("munmap");
-		return 1;
+
+	if ((off_t)image->txtoff + aout->a_text + aout->a_data > image->file_size) {
+		fprintf(stderr, "%s: truncated: text and data extend past end of file\n", name);
+		return -1;
 	}
 
-	image_end = ALIGN(image + image_bytes, pagesize);
+	return 0;
+}
 
-	if (aout->a_syms != 0) {
-		fprintf(stderr, "%s: a.out header a_syms must be 0.\n", argv[1]);
-		return 1;
+/*
+ * When the file offsets and load addresses are page aligned (QMAGIC),
+ * text and data can be mapped straight from the file, so nothing is
+ * copied, and text pages are shared through the page cache between
+ * every process running the same binary. Protections match what the
+ * kernel's binfmt_aout used: text is read/exec, data is read/write/exec.
+ * If text doesn't end on a page boundary, text and data share a page and
+ * get mapped together with the union of both.
+ */
+static int map_aout_file(int fd, struct aout_image *image, int pagesize)
+{
+	struct a_out *aout = &image->hdr;
+	unsigned char *text = (unsigned char *)image->load_addr;
+	unsigned char *data = text + aout->a_text;
+
+	if (!IS_ALIGNED(aout->a_text, pagesize)) {
+		if (mmap(text, aout->a_text + aout->a_data,
+			 PROT_READ | PROT_WRITE | PROT_EXEC,
+			 MAP_FIXED | MAP_PRIVATE, fd, image->txtoff) == MAP_FAILED) {
+			perror("mmap text/data");
+			check_mmap_min_addr(image->load_addr, image->file_type);
+			return -1;
+		}
+		return 0;
 	}
 
-	if (aout->a_trsize != 0) {
-		fprintf(stderr, "%s: a.out header a_trsize must be 0.\n", argv[1]);
-		return 1;
+	if (aout->a_text &&
+	    mmap(text, aout->a_text, PROT_READ | PROT_EXEC,
+		 MAP_FIXED | MAP_PRIVATE, fd, image->txtoff) == MAP_FAILED) {
+		perror("mmap text");
+		check_mmap_min_addr(image->load_addr, image->file_type);
+		return -1;
+	}
+	if (aout->a_data &&
+	    mmap(data, aout->a_data, PROT_READ | PROT_WRITE | PROT_EXEC,
+		 MAP_FIXED | MAP_PRIVATE, fd, image->txtoff + aout->a_text) == MAP_FAILED) {
+		perror("mmap data");
+		return -1;
 	}
 
-	if (aout->a_drsize != 0) {
-		fprintf(stderr, "%s: a.out header a_drsize must be 0.\n", argv[1]);
-		return 1;
+	return 0;
+}
+
+/*
+ * When the file layout isn't page aligned (ZMAGIC's 0x400 text offset
+ * with a 0x0 load address), fall back to copying, but only text and data
+ * rather than the whole file.
+ */
+static int map_aout_copy(int fd, struct aout_image *image)
+{
+	struct a_out *aout = &image->hdr;
+	size_t bytes = aout->a_text + aout->a_data;
+	unsigned char *dest;
+	size_t done = 0;
+
+	dest = mmap((void *)image->load_addr, bytes,
+		    PROT_EXEC | PROT_READ | PROT_WRITE,
+		    MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (dest == MAP_FAILED) {
+		perror("mmap");
+		check_mmap_min_addr(image->load_addr, image->file_type);
+		return -1;
 	}
 
-	/* See if .bss needs to extend beyond end of the file mmap. */
-	bss = image + aout->a_text + aout->a_data;
+	while (done < bytes) {
+		ssize_t got = pread(fd, dest + done, bytes - done,
+				    image->txtoff + done);
+
+		if (got < 0) {
+			perror(image->name);
+			return -1;
+		}
+		if (got == 0) {
+			fprintf(stderr, "%s: short read\n", image->name);
+			return -1;
+		}
+		done += got;
+	}
+
+	return 0;
+}
+
+/* Map text, data, and bss at the load address. */
+static int map_aout(int fd, struct aout_image *image, int pagesize)
+{
+	struct a_out *aout = &image->hdr;
+	unsigned char *bss, *bss_end, *image_end;
+	int ret;
+
+	if (IS_ALIGNED(image->load_addr, pagesize) &&
+	    IS_ALIGNED(image->txtoff, pagesize))
+		ret = map_aout_file(fd, image, pagesize);
+	else
+		ret = map_aout_copy(fd, image);
+	if (ret < 0)
+		return ret;
+
+	bss = (unsigned char *)image->load_addr + aout->a_text + aout->a_data;
 	bss_end = bss + aout->a_bss;
+	image_end = ALIGN(bss, pagesize);
+
+	/*
+	 * Only the page where .bss starts can hold anything but zeros: the
+	 * file mapping shows whatever follows data in the file there. Clear
+	 * just that tail, and let fresh anonymous pages cover the rest so
+	 * they are only faulted in when the program touches them.
+	 */
+	if (aout->a_bss && bss < image_end)
+		memset(bss, 0, image_end - bss);
+
 	if (bss_end > image_end) {
-		bss = mmap(bss, aout->a_bss, PROT_READ | PROT_WRITE,
-			   MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-		if (bss == MAP_FAILED) {
+		if (mmap(image_end, bss_end - image_end, PROT_READ | PROT_WRITE,
+			 MAP_FIXED | MAP_ANONYMOUS | MAP_PRIVATE, -1, 0) == MAP_FAILED) {
 			perror("mmap bss");
-			return 1;
+			return -1;
 		}
 	}
-	/* Zero out .bss. */
-	memset(bss, 0, ALIGN(aout->a_bss, pagesize));
 
-	/* Prepare stack, based on current stack. */
+	return 0;
+}
+
+/* Top of the program's stack, for the profiler's frame walk. */
+static unsigned char *stack_top;
+
+/*
+ * Reserve a stack of RLIMIT_STACK size (8MiB if unlimited) with a
+ * PROT_NONE guard page below it. MAP_NORESERVE means only the pages the
+ * program actually touches cost anything, which is what MAP_GROWSDOWN
+ * would give, without its habit of being grown into by other mappings.
+ * The stack is not executable unless asked for.
+ */
+static unsigned char *map_stack(int pagesize, int exec_stack)
+{
+	unsigned char *guard;
+	struct rlimit rlim;
+	size_t size;
+	int prot = PROT_READ | PROT_WRITE;
+
 	if (getrlimit(RLIMIT_STACK, &rlim) < 0) {
 		perror("getrlimit");
-		return 1;
+		return NULL;
 	}
 
 	/* Default to 8MiB */
 	if (rlim.rlim_cur == RLIM_INFINITY)
 		rlim.rlim_cur = 8 * 1024 * 1024;
+	size = ALIGN((size_t)rlim.rlim_cur, pagesize);
 
-	stack = mmap(NULL, rlim.rlim_cur, PROT_EXEC | PROT_READ | PROT_WRITE,
-			MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-	if (stack == MAP_FAILED) {
+	guard = mmap(NULL, size + pagesize, PROT_NONE,
+		     MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (guard == MAP_FAILED) {
 		perror("mmap stack");
-		return 1;
+		return NULL;
+	}
+
+	if (exec_stack)
+		prot |= PROT_EXEC;
+	if (mprotect(guard + pagesize, size, prot) < 0) {
+		perror("mprotect stack");
+		return NULL;
 	}
-	stack_end = ALIGN(stack + rlim.rlim_cur, pagesize);
+
+	stack_top = guard + pagesize + size;
+	return stack_top;
+}
+
+/*
+ * Lay out argc, argv, and envp at the top of the stack the way the
+ * kernel does for an a.out process, returning the initial stack pointer.
+ */
+static unsigned long *setup_stack(unsigned char *stack_end, int argc,
+				  char *argv[], char *envp[])
+{
+	unsigned long *sp;
+	char **p;
+	int envc;
+	char **argv_copy, **envp_copy;
 
 	/* Fill top of stack with arg/env pointers. */
 	sp = (unsigned long *)stack_end;
 	sp--;
 
-	/* do not include argv[0] */
-	argc_copy = argc - 1;
-	argv++;
-
 	/* count envp */
-	for (envc_copy = 0, p = envp; *p; envc_copy++, p++) ;
+	for (envc = 0, p = envp; *p; envc++, p++) ;
 
 	/* make room for envp pointers */
-	sp -= envc_copy + 1;
+	sp -= envc + 1;
 	envp_copy = (char **)sp;
 	/* make room for argv pointers */
-	sp -= argc_copy + 1;
+	sp -= argc + 1;
 	argv_copy = (char **)sp;
 
 	/* store pointers and argc */
 	*--sp = (unsigned long)envp_copy;
 	*--sp = (unsigned long)argv_copy;
-	*--sp = (unsigned long)argc_copy;
+	*--sp = (unsigned long)argc;
 
 	/* copy argv pointer (contents can stay where they already are) */
-	while (argc_copy--)
+	while (argc--)
 		*argv_copy++ = *argv++;
 	*argv_copy = 0;
 
 	/* copy envp (contents can stay where they already are) */
-	while (envc_copy--)
+	while (envc--)
 		*envp_copy++ = *envp++;
+	*envp_copy = 0;
+
+	return sp;
+}
+
+/*
+ * Called once the stack is in place, right before the jump, for modes
+ * that need the very last word before the program starts.
+ */
+static int (*before_jump)(void);
+
+/* Copy text and data from the file to the current position of "out". */
+static int copy_text_data(int fd, struct aout_image *image, int out)
+{
+	size_t bytes = image->hdr.a_text + image->hdr.a_data;
+	size_t done = 0;
+	char buf[65536];
+
+	while (done < bytes) {
+		size_t want = bytes - done < sizeof(buf) ? bytes - done : sizeof(buf);
+		ssize_t got = pread(fd, buf, want, image->txtoff + done);
+
+		if (got <= 0) {
+			fprintf(stderr, "%s: short read\n", image->name);
+			return -1;
+		}
+		if (write(out, buf, got) != got) {
+			perror("write");
+			return -1;
+		}
+		done += got;
+	}
+
+	return 0;
+}
+
+/* Set up the stack and jump to the entry point; only returns on failure. */
+static int start_aout(struct aout_image *image, int argc, char *argv[],
+		      char *envp[], int pagesize, int exec_stack)
+{
+	unsigned char *stack_end;
+	unsigned long *sp;
+
+	/* Prepare stack, based on current stack. */
+	stack_end = map_stack(pagesize, exec_stack);
+	if (!stack_end)
+		return -1;
+	sp = setup_stack(stack_end, argc, argv, envp);
+	if (before_jump && before_jump() < 0)
+		return -1;
 
 	/* Aim sp at argc, and jump! */
-	asm volatile ("movl %0, %%esp\njmp *%1\n" : : "rm" (sp), "r"(aout->a_entry));
+	asm volatile ("movl %0, %%esp\njmp *%1\n" : : "rm" (sp), "r"(image->hdr.a_entry));
 
 	/* This should be unreachable. */
 	fprintf(stderr, "They found me. I don't how, but they found me.\n");
+	return -1;
+}
+
+/*
+ * Batch mode: run a list of "a.out [arg ...]" lines (blank lines and
+ * #comments are skipped), each in its own forked child. Every distinct
+ * binary is parsed once and its text and data are copied into a sealed
+ * memfd laid out exactly as they appear in memory, so each run is a fork
+ * plus a few page-aligned file mappings, whatever the original layout.
+ */
+struct batch_image {
+	struct aout_image image;
+	char *path;
+	int fd;		/* snapshot, or -1 if the binary couldn't be loaded */
+};
+
+struct batch_run {
+	size_t bin;	/* index into batch->bins */
+	int argc;
+	char **argv;
+};
+
+struct batch {
+	struct batch_image *bins;
+	size_t nbins;
+	struct batch_run *runs;
+	size_t nruns;
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double now_ms(void)
+{
+	return now_ns() / 1e6;
+}
+
+static int snapshot_aout(const char *path, struct batch_image *bin)
+{
+	struct aout_image *image = &bin->image;
+	int fd, snap;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	if (parse_aout(fd, path, image, 0) < 0)
+		goto close_fd;
+
+	snap = memfd_create("aout-snapshot", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (snap < 0) {
+		perror("memfd_create");
+		goto close_fd;
+	}
+
+	if (copy_text_data(fd, image, snap) < 0)
+		goto close_snap;
+	if (fcntl(snap, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				     F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		perror("seal snapshot");
+		goto close_snap;
+	}
+	close(fd);
+
+	/* The snapshot starts with text. */
+	image->txtoff = 0;
+	bin->fd = snap;
+	return 0;
+
+close_snap:
+	close(snap);
+close_fd:
+	close(fd);
+	return -1;
+}
+
+static size_t batch_image(struct batch *batch, const char *path)
+{
+	struct batch_image *bins, *bin;
+	size_t i;
+
+	for (i = 0; i < batch->nbins; i++)
+		if (strcmp(batch->bins[i].path, path) == 0)
+			return i;
+
+	bins = realloc(batch->bins, (batch->nbins + 1) * sizeof(*bins));
+	if (!bins) {
+		perror("realloc");
+		exit(1);
+	}
+	batch->bins = bins;
+	bin = &bins[batch->nbins];
+
+	bin->path = strdup(path);
+	if (snapshot_aout(path, bin) < 0)
+		bin->fd = -1;
+	bin->image.name = bin->path;
+	return batch->nbins++;
+}
+
+static int read_batch(const char *list, struct batch *batch)
+{
+	char *line = NULL;
+	size_t len = 0;
+	FILE *in;
+
+	in = strcmp(list, "-") == 0 ? stdin : fopen(list, "r");
+	if (!in) {
+		perror(list);
+		return -1;
+	}
+
+	while (getline(&line, &len, in) != -1) {
+		struct batch_run *run;
+		char *word, *save;
+		char **argv = NULL;
+		int argc = 0;
+
+		for (word = strtok_r(line, " \t\n", &save); word;
+		     word = strtok_r(NULL, " \t\n", &save)) {
+			if (argc == 0 && word[0] == '#')
+				break;
+			argv = realloc(argv, (argc + 2) * sizeof(*argv));
+			if (!argv) {
+				perror("realloc");
+				exit(1);
+			}
+			argv[argc++] = strdup(word);
+		}
+		if (!argc)
+			continue;
+		argv[argc] = NULL;
+
+		run = realloc(batch->runs, (batch->nruns + 1) * sizeof(*run));
+		if (!run) {
+			perror("realloc");
+			exit(1);
+		}
+		batch->runs = run;
+		run += batch->nruns++;
+		run->argc = argc;
+		run->argv = argv;
+		run->bin = batch_image(batch, argv[0]);
+	}
+	free(line);
+	if (in != stdin)
+		fclose(in);
+
+	return 0;
+}
+
+static int run_batch(const char *list, char *envp[], int pagesize, int exec_stack)
+{
+	struct batch batch = { };
+	size_t i, failed = 0;
+	double total = 0;
+	int j;
+
+	if (read_batch(list, &batch) < 0)
+		return 1;
+
+	fprintf(stderr, "# run\tstatus\twall-ms\tminflt\tmaxrss-KiB\tcommand\n");
+	for (i = 0; i < batch.nruns; i++) {
+		struct batch_run *run = &batch.runs[i];
+		struct batch_image *bin = &batch.bins[run->bin];
+		struct rusage ru;
+		char status[32];
+		double start, elapsed;
+		int wstatus;
+		pid_t pid;
+
+		if (bin->fd < 0) {
+			fprintf(stderr, "%zu\tunloadable\t-\t-\t-\t%s\n", i, run->argv[0]);
+			failed++;
+			continue;
+		}
+
+		fflush(NULL);
+		start = now_ms();
+		pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			size_t k;
+
+			if (map_aout(bin->fd, &bin->image, pagesize) < 0)
+				_exit(127);
+			/* Don't leak the snapshots into the program. */
+			for (k = 0; k < batch.nbins; k++)
+				if (batch.bins[k].fd >= 0)
+					close(batch.bins[k].fd);
+			start_aout(&bin->image, run->argc, run->argv, envp,
+				   pagesize, exec_stack);
+			_exit(127);
+		}
+		if (wait4(pid, &wstatus, 0, &ru) < 0) {
+			perror("wait4");
+			return 1;
+		}
+		elapsed = now_ms() - start;
+		total += elapsed;
+
+		if (WIFSIGNALED(wstatus))
+			snprintf(status, sizeof(status), "signal(%d)", WTERMSIG(wstatus));
+		else
+			snprintf(status, sizeof(status), "exit(%d)", WEXITSTATUS(wstatus));
+		if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0)
+			failed++;
+
+		fprintf(stderr, "%zu\t%s\t%.3f\t%ld\t%ld\t", i, status, elapsed,
+			ru.ru_minflt, ru.ru_maxrss);
+		for (j = 0; j < run->argc; j++)
+			fprintf(stderr, "%s%s", j ? " " : "", run->argv[j]);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "# %zu runs of %zu binaries, %zu failed, %.3f ms total\n",
+		batch.nruns, batch.nbins, failed, total);
+
+	return failed ? 1 : 0;
+}
+
+/*
+ * Profile mode: run the program in a child with an ITIMER_PROF sampler
+ * armed right before the jump to its entry point. The SIGPROF handler
+ * only records the interrupted EIP, plus return addresses found by
+ * following the EBP chain while it stays inside the stack and points
+ * back into text, into a preallocated buffer shared with the parent.
+ * Once the program exits, the parent symbolizes the samples with the
+ * a.out symbol table and writes a flat profile to PREFIX.flat and
+ * folded stacks (for flamegraph.pl and friends) to PREFIX.folded.
+ */
+#define PROFILE_DEPTH		32
+#define PROFILE_SAMPLES		(1 << 16)
+#define PROFILE_HZ		1000
+
+/* The handler runs with whatever %gs the program left behind. */
+#define __no_stack_protector	__attribute__((__optimize__("no-stack-protector")))
+
+/* a.out symbol table entry (struct nlist). */
+struct aout_nlist {
+	int n_strx;		/* offset into string table */
+	unsigned char n_type;
+	char n_other;
+	short n_desc;
+	unsigned int n_value;
+};
+
+#define N_STAB		0xe0	/* any of these bits set: debugger entry */
+#define N_TYPE		0x1e
+#define N_TEXT		0x04
+
+struct aout_sym {
+	unsigned long addr;
+	const char *name;
+};
+
+struct profile_sample {
+	unsigned int depth;
+	unsigned int pc[PROFILE_DEPTH];
+};
+
+struct profile_buf {
+	unsigned int capacity;
+	unsigned int used;
+	unsigned int dropped;
+	struct profile_sample samples[];
+};
+
+static struct profile_buf *profile_buf;
+static unsigned long text_start, text_end;
+
+static int compare_syms(const void *a, const void *b)
+{
+	const struct aout_sym *left = a, *right = b;
+
+	if (left->addr != right->addr)
+		return left->addr < right->addr ? -1 : 1;
+	return strcmp(left->name, right->name);
+}
+
+/*
+ * The symbol table follows data (there are no relocations), and the
+ * string table follows that, starting with its own 4-byte length.
+ * Only text symbols are kept, sorted by address.
+ */
+static int load_symbols(int fd, struct aout_image *image,
+			struct aout_sym **syms_out, size_t *nsyms_out)
+{
+	struct a_out *aout = &image->hdr;
+	off_t symoff = (off_t)image->txtoff + aout->a_text + aout->a_data;
+	off_t stroff = symoff + aout->a_syms;
+	struct aout_nlist *nl;
+	struct aout_sym *syms;
+	size_t i, count, nsyms = 0;
+	unsigned int strsize;
+	char *strtab;
+
+	if (stroff + sizeof(strsize) > image->file_size ||
+	    pread(fd, &strsize, sizeof(strsize), stroff) != sizeof(strsize) ||
+	    strsize < sizeof(strsize) || stroff + strsize > image->file_size) {
+		fprintf(stderr, "%s: missing or truncated symbol table\n", image->name);
+		return -1;
+	}
+
+	count = aout->a_syms / sizeof(*nl);
+	nl = malloc(aout->a_syms);
+	/* Keep a NUL at the end so a corrupt last name stays bounded. */
+	strtab = malloc(strsize + 1);
+	syms = calloc(count ? count : 1, sizeof(*syms));
+	if (!nl || !strtab || !syms) {
+		perror("malloc");
+		return -1;
+	}
+	if (pread(fd, nl, aout->a_syms, symoff) != aout->a_syms ||
+	    pread(fd, strtab, strsize, stroff) != strsize) {
+		fprintf(stderr, "%s: short read of symbol table\n", image->name);
+		return -1;
+	}
+	strtab[strsize] = '\0';
+
+	for (i = 0; i < count; i++) {
+		if (nl[i].n_type & N_STAB)
+			continue;
+		if ((nl[i].n_type & N_TYPE) != N_TEXT)
+			continue;
+		if (nl[i].n_strx < sizeof(strsize) || nl[i].n_strx >= strsize)
+			continue;
+		syms[nsyms].addr = nl[i].n_value;
+		syms[nsyms].name = strtab + nl[i].n_strx;
+		nsyms++;
+	}
+	free(nl);
+
+	qsort(syms, nsyms, sizeof(*syms), compare_syms);
+	*syms_out = syms;
+	*nsyms_out = nsyms;
+	return 0;
+}
+
+/* Index of the symbol covering pc, or nsyms for no symbol. */
+static size_t find_symbol(const struct aout_sym *syms, size_t nsyms, unsigned long pc)
+{
+	size_t lo = 0, hi = nsyms;
+
+	if (pc < text_start || pc >= text_end)
+		return nsyms;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (syms[mid].addr <= pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? lo - 1 : nsyms;
+}
+
+static const char *symbol_name(const struct aout_sym *syms, size_t nsyms, unsigned long pc)
+{
+	size_t i = find_symbol(syms, nsyms, pc);
+
+	if (i < nsyms)
+		return syms[i].name;
+	return pc >= text_start && pc < text_end ? "[unknown]" : "[outside a.out]";
+}
+
+static void __no_stack_protector profile_sample(int sig, siginfo_t *info, void *context)
+{
+	ucontext_t *uc = context;
+	struct profile_sample *sample;
+	unsigned long fp, sp;
+
+	if (profile_buf->used >= profile_buf->capacity) {
+		profile_buf->dropped++;
+		return;
+	}
+	sample = &profile_buf->samples[profile_buf->used++];
+
+	sample->pc[0] = uc->uc_mcontext.gregs[REG_EIP];
+	sample->depth = 1;
+	if (sample->pc[0] < text_start || sample->pc[0] >= text_end)
+		return;
+
+	/* Each frame holds the caller's frame pointer, then the return address. */
+	sp = uc->uc_mcontext.gregs[REG_ESP];
+	fp = uc->uc_mcontext.gregs[REG_EBP];
+	while (sample->depth < PROFILE_DEPTH) {
+		unsigned long *frame = (unsigned long *)fp;
+		unsigned long ret;
+
+		if (fp < sp || fp & 3 || fp + 2 * sizeof(*frame) > (unsigned long)stack_top)
+			break;
+		ret = frame[1];
+		if (ret < text_start || ret >= text_end)
+			break;
+		sample->pc[sample->depth++] = ret;
+		/* Frames only ever move up the stack. */
+		sp = fp + 2 * sizeof(*frame);
+		fp = frame[0];
+	}
+}
+
+static int arm_profiler(int hz)
+{
+	struct sigaction sa = { };
+	struct itimerval timer = { };
+	stack_t alt;
+
+	/* Keep signal frames off the program's own stack. */
+	alt.ss_size = 64 * 1024;
+	alt.ss_flags = 0;
+	alt.ss_sp = mmap(NULL, alt.ss_size, PROT_READ | PROT_WRITE,
+			 MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (alt.ss_sp == MAP_FAILED || sigaltstack(&alt, NULL) < 0) {
+		perror("sigaltstack");
+		return -1;
+	}
+
+	sa.sa_sigaction = profile_sample;
+	sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) < 0) {
+		perror("sigaction");
+		return -1;
+	}
+
+	timer.it_interval.tv_sec = 1 / hz;
+	timer.it_interval.tv_usec = (1000000 / hz) % 1000000;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+		perror("setitimer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int compare_counts(const void *a, const void *b, void *counts)
+{
+	const unsigned int *count = counts;
+	size_t left = *(const size_t *)a, right = *(const size_t *)b;
+
+	if (count[left] != count[right])
+		return count[left] < count[right] ? 1 : -1;
+	return left < right ? -1 : left > right;
+}
+
+static int compare_strings(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int write_flat(const char *path, const struct aout_sym *syms, size_t nsyms, int hz)
+{
+	/* Two extra buckets: "[unknown]" in text, and outside text. */
+	unsigned int *counts = calloc(nsyms + 2, sizeof(*counts));
+	size_t *order = calloc(nsyms + 2, sizeof(*order));
+	unsigned int i, total = profile_buf->used;
+	FILE *out;
+
+	if (!counts || !order) {
+		perror("calloc");
+		return -1;
+	}
+	for (i = 0; i < total; i++) {
+		unsigned long pc = profile_buf->samples[i].pc[0];
+		size_t sym = find_symbol(syms, nsyms, pc);
+
+		if (sym == nsyms && (pc < text_start || pc >= text_end))
+			sym = nsyms + 1;
+		counts[sym]++;
+	}
+	for (i = 0; i < nsyms + 2; i++)
+		order[i] = i;
+	qsort_r(order, nsyms + 2, sizeof(*order), compare_counts, counts);
+
+	out = fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return -1;
+	}
+	fprintf(out, "# %u samples at %d Hz", total, hz);
+	if (profile_buf->dropped)
+		fprintf(out, " (%u dropped: buffer full)", profile_buf->dropped);
+	fprintf(out, "\n# %8s %7s  %s\n", "samples", "percent", "symbol");
+	for (i = 0; i < nsyms + 2 && counts[order[i]]; i++) {
+		const char *name = order[i] < nsyms ? syms[order[i]].name :
+				   order[i] == nsyms ? "[unknown]" : "[outside a.out]";
+
+		fprintf(out, "  %8u %6.2f%%  %s\n", counts[order[i]],
+			counts[order[i]] * 100.0 / total, name);
+	}
+	fclose(out);
+	free(counts);
+	free(order);
+	return 0;
+}
+
+static int write_folded(const char *path, const struct aout_sym *syms, size_t nsyms)
+{
+	unsigned int i, total = profile_buf->used;
+	char **stacks = calloc(total ? total : 1, sizeof(*stacks));
+	FILE *out;
+
+	if (!stacks) {
+		perror("calloc");
+		return -1;
+	}
+	/* Root first; return addresses point after the call, so back up one. */
+	for (i = 0; i < total; i++) {
+		struct profile_sample *sample = &profile_buf->samples[i];
+		size_t len = 0, size = 0;
+		FILE *stack = open_memstream(&stacks[i], &size);
+		int depth;
+
+		if (!stack) {
+			perror("open_memstream");
+			return -1;
+		}
+		for (depth = sample->depth - 1; depth >= 0; depth--) {
+			unsigned long pc = sample->pc[depth] - (depth ? 1 : 0);
+
+			fprintf(stack, "%s%s", len++ ? ";" : "",
+				symbol_name(syms, nsyms, pc));
+		}
+		fclose(stack);
+	}
+	qsort(stacks, total, sizeof(*stacks), compare_strings);
+
+	out = fopen(path, "w");
+	if (!out) {
+		perror(path);
+		return -1;
+	}
+	for (i = 0; i < total; ) {
+		unsigned int j;
+
+		for (j = i + 1; j < total && strcmp(stacks[i], stacks[j]) == 0; j++)
+			;
+		fprintf(out, "%s %u\n", stacks[i], j - i);
+		i = j;
+	}
+	fclose(out);
+	for (i = 0; i < total; i++)
+		free(stacks[i]);
+	free(stacks);
+	return 0;
+}
+
+static int run_profiled(int fd, struct aout_image *image, int argc, char *argv[],
+			char *envp[], int pagesize, int exec_stack,
+			const char *prefix, int hz)
+{
+	struct aout_sym *syms;
+	size_t nsyms, bytes;
+	char path[PATH_MAX];
+	int wstatus;
+	pid_t pid;
+
+	if (load_symbols(fd, image, &syms, &nsyms) < 0)
+		return 1;
+	text_start = image->load_addr;
+	text_end = text_start + image->hdr.a_text;
+
+	bytes = sizeof(*profile_buf) + PROFILE_SAMPLES * sizeof(profile_buf->samples[0]);
+	profile_buf = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (profile_buf == MAP_FAILED) {
+		perror("mmap profile buffer");
+		return 1;
+	}
+	profile_buf->capacity = PROFILE_SAMPLES;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0) {
+		if (map_aout(fd, image, pagesize) < 0)
+			_exit(127);
+		close(fd);
+		if (arm_profiler(hz) < 0)
+			_exit(127);
+		start_aout(image, argc, argv, envp, pagesize, exec_stack);
+		_exit(127);
+	}
+	close(fd);
+	if (waitpid(pid, &wstatus, 0) < 0) {
+		perror("waitpid");
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s.flat", prefix);
+	if (write_flat(path, syms, nsyms, hz) < 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s.folded", prefix);
+	if (write_folded(path, syms, nsyms) < 0)
+		return 1;
+	fprintf(stderr, "%s: %u samples written to %s.flat and %s.folded\n",
+		image->name, profile_buf->used, prefix, prefix);
+
+	if (WIFSIGNALED(wstatus))
+		return 128 + WTERMSIG(wstatus);
+	return WEXITSTATUS(wstatus);
+}
+
+/*
+ * Trace mode: right before the jump, the child installs a seccomp filter
+ * that hands every i386 syscall to a ptrace supervisor (the parent)
+ * with SECCOMP_RET_TRACE. The supervisor only stops the program twice
+ * per syscall (seccomp stop at entry, then syscall-exit stop), and lets
+ * user code run freely in between with PTRACE_CONT. Latencies are taken
+ * between those two stops, so each includes one tracer wakeup; compare
+ * against the total user/system time to see where the time goes.
+ * Children the program forks are followed, since a traced filter with
+ * no tracer attached would fail their syscalls with ENOSYS.
+ */
+#define TRACE_SYSCALLS		512
+#define TRACE_OTHER		TRACE_SYSCALLS	/* slot for anything past the table */
+#define TRACE_BUCKETS		40	/* log2(ns) */
+
+struct syscall_stats {
+	unsigned long long count;
+	unsigned long long timed;	/* count, less those with no exit stop */
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long buckets[TRACE_BUCKETS];
+};
+
+struct tracee {
+	pid_t pid;
+	int nr;			/* syscall in progress, or -1 */
+	int started;		/* seen past its initial stop */
+	unsigned long long entry_ns;
+};
+
+/* The legacy i386 syscalls an a.out program is likely to make. */
+static const char * const syscall_names[TRACE_SYSCALLS] = {
+	[1] = "exit",		[2] = "fork",		[3] = "read",
+	[4] = "write",		[5] = "open",		[6] = "close",
+	[7] = "waitpid",	[8] = "creat",		[9] = "link",
+	[10] = "unlink",	[11] = "execve",	[12] = "chdir",
+	[13] = "time",		[14] = "mknod",		[15] = "chmod",
+	[16] = "lchown",	[18] = "oldstat",	[19] = "lseek",
+	[20] = "getpid",	[21] = "mount",		[22] = "umount",
+	[23] = "setuid",	[24] = "getuid",	[25] = "stime",
+	[26] = "ptrace",	[27] = "alarm",		[28] = "oldfstat",
+	[29] = "pause",		[30] = "utime",		[33] = "access",
+	[34] = "nice",		[36] = "sync",		[37] = "kill",
+	[38] = "rename",	[39] = "mkdir",		[40] = "rmdir",
+	[41] = "dup",		[42] = "pipe",		[43] = "times",
+	[45] = "brk",		[46] = "setgid",	[47] = "getgid",
+	[48] = "signal",	[49] = "geteuid",	[50] = "getegid",
+	[54] = "ioctl",		[55] = "fcntl",		[57] = "setpgid",
+	[60] = "umask",		[61] = "chroot",	[63] = "dup2",
+	[64] = "getppid",	[65] = "getpgrp",	[66] = "setsid",
+	[67] = "sigaction",	[72] = "sigsuspend",	[73] = "sigpending",
+	[75] = "setrlimit",	[76] = "getrlimit",	[77] = "getrusage",
+	[78] = "gettimeofday",	[79] = "settimeofday",	[82] = "select",
+	[83] = "symlink",	[84] = "oldlstat",	[85] = "readlink",
+	[86] = "uselib",	[89] = "readdir",	[90] = "mmap",
+	[91] = "munmap",	[92] = "truncate",	[93] = "ftruncate",
+	[94] = "fchmod",	[95] = "fchown",	[99] = "statfs",
+	[100] = "fstatfs",	[102] = "socketcall",	[104] = "setitimer",
+	[105] = "getitimer",	[106] = "stat",		[107] = "lstat",
+	[108] = "fstat",	[109] = "olduname",	[114] = "wait4",
+	[116] = "sysinfo",	[117] = "ipc",		[118] = "fsync",
+	[119] = "sigreturn",	[120] = "clone",	[122] = "uname",
+	[125] = "mprotect",	[126] = "sigprocmask",	[136] = "personality",
+	[140] = "_llseek",	[141] = "getdents",	[142] = "_newselect",
+	[143] = "flock",	[144] = "msync",	[145] = "readv",
+	[146] = "writev",	[162] = "nanosleep",	[163] = "mremap",
+	[168] = "poll",		[173] = "rt_sigreturn",	[174] = "rt_sigaction",
+	[175] = "rt_sigprocmask", [183] = "getcwd",	[192] = "mmap2",
+	[252] = "exit_group",
+};
+
+static int install_trace_filter(void)
+{
+	struct sock_filter filter[] = {
+		/* Leave anything that isn't the i386 syscall ABI alone. */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_I386, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+		/* Otherwise trace, passing the syscall number as the event data. */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+		BPF_STMT(BPF_ALU | BPF_OR | BPF_K, SECCOMP_RET_TRACE),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = sizeof(filter) / sizeof(filter[0]),
+		.filter = filter,
+	};
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+		perror("PR_SET_NO_NEW_PRIVS");
+		return -1;
+	}
+	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) < 0) {
+		perror("PR_SET_SECCOMP");
+		return -1;
+	}
+	return 0;
+}
+
+static struct tracee *find_tracee(struct tracee **tracees, size_t *count, pid_t pid)
+{
+	struct tracee *t;
+	size_t i;
+
+	for (i = 0; i < *count; i++)
+		if ((*tracees)[i].pid == pid)
+			return &(*tracees)[i];
+
+	t = realloc(*tracees, (*count + 1) * sizeof(*t));
+	if (!t) {
+		perror("realloc");
+		exit(1);
+	}
+	*tracees = t;
+	t += (*count)++;
+	t->pid = pid;
+	t->nr = -1;
+	t->started = 0;
+	return t;
+}
+
+static struct syscall_stats *syscall_slot(struct syscall_stats *stats, int nr)
+{
+	return &stats[nr >= 0 && nr < TRACE_SYSCALLS ? nr : TRACE_OTHER];
+}
+
+static void record_syscall(struct syscall_stats *stats, int nr, unsigned long long ns)
+{
+	struct syscall_stats *s = syscall_slot(stats, nr);
+	int bucket = 0;
+
+	while (bucket < TRACE_BUCKETS - 1 && (1ULL << (bucket + 1)) <= ns)
+		bucket++;
+	s->count++;
+	s->timed++;
+	s->total_ns += ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->buckets[bucket]++;
+}
+
+static int compare_stats(const void *a, const void *b, void *stats)
+{
+	const struct syscall_stats *s = stats;
+	int left = *(const int *)a, right = *(const int *)b;
+
+	if (s[left].total_ns != s[right].total_ns)
+		return s[left].total_ns < s[right].total_ns ? 1 : -1;
+	return left - right;
+}
+
+static void report_syscalls(struct syscall_stats *stats, unsigned long long wall_ns,
+			    struct rusage *ru)
+{
+	unsigned long long total_ns = 0, total_count = 0;
+	int order[TRACE_OTHER + 1];
+	int i, used = 0;
+
+	for (i = 0; i <= TRACE_OTHER; i++) {
+		if (!stats[i].count)
+			continue;
+		order[used++] = i;
+		total_ns += stats[i].total_ns;
+		total_count += stats[i].count;
+	}
+	qsort_r(order, used, sizeof(*order), compare_stats, stats);
+
+	fprintf(stderr, "# wall %.3f ms, user %.3f ms, system %.3f ms, %llu syscalls taking %.3f ms\n",
+		wall_ns / 1e6,
+		ru->ru_utime.tv_sec * 1e3 + ru->ru_utime.tv_usec / 1e3,
+		ru->ru_stime.tv_sec * 1e3 + ru->ru_stime.tv_usec / 1e3,
+		total_count, total_ns / 1e6);
+	fprintf(stderr, "# %-16s %10s %12s %10s %10s\n",
+		"syscall", "count", "total-us", "avg-us", "max-us");
+	for (i = 0; i < used; i++) {
+		struct syscall_stats *s = &stats[order[i]];
+		char name[32];
+		int b;
+
+		if (order[i] == TRACE_OTHER)
+			snprintf(name, sizeof(name), "other");
+		else if (syscall_names[order[i]])
+			snprintf(name, sizeof(name), "%s", syscall_names[order[i]]);
+		else
+			snprintf(name, sizeof(name), "syscall_%d", order[i]);
+		if (!s->timed) {
+			fprintf(stderr, "  %-16s %10llu %12s %10s %10s\n", name,
+				s->count, "n/a", "n/a", "n/a");
+			continue;
+		}
+		fprintf(stderr, "  %-16s %10llu %12.1f %10.2f %10.1f\n", name,
+			s->count, s->total_ns / 1e3, s->total_ns / 1e3 / s->timed,
+			s->max_ns / 1e3);
+		for (b = 0; b < TRACE_BUCKETS; b++) {
+			if (!s->buckets[b])
+				continue;
+			fprintf(stderr, "      < %12llu ns %10llu %5.1f%%\n",
+				1ULL << (b + 1), s->buckets[b],
+				s->buckets[b] * 100.0 / s->timed);
+		}
+	}
+}
+
+static int run_traced(int fd, struct aout_image *image, int argc, char *argv[],
+		      char *envp[], int pagesize, int exec_stack)
+{
+	struct syscall_stats *stats;
+	struct tracee *tracees = NULL;
+	size_t ntracees = 0;
+	unsigned long long start;
+	struct rusage ru = { };
+	int wstatus, result = 1;
+	pid_t pid, child;
+
+	stats = calloc(TRACE_OTHER + 1, sizeof(*stats));
+	if (!stats) {
+		perror("calloc");
+		return 1;
+	}
+
+	fflush(NULL);
+	start = now_ns();
+	child = fork();
+	if (child < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (child == 0) {
+		if (map_aout(fd, image, pagesize) < 0)
+			_exit(127);
+		close(fd);
+		/* Wait for the supervisor to attach before going any further. */
+		if (ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0) {
+			perror("PTRACE_TRACEME");
+			_exit(127);
+		}
+		raise(SIGSTOP);
+		before_jump = install_trace_filter;
+		start_aout(image, argc, argv, envp, pagesize, exec_stack);
+		_exit(127);
+	}
+	close(fd);
+
+	if (waitpid(child, &wstatus, 0) < 0 || !WIFSTOPPED(wstatus)) {
+		fprintf(stderr, "%s: child did not stop for tracing\n", image->name);
+		return 1;
+	}
+	if (ptrace(PTRACE_SETOPTIONS, child, NULL,
+		   PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD |
+		   PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK |
+		   PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC |
+		   PTRACE_O_EXITKILL) < 0) {
+		perror("PTRACE_SETOPTIONS");
+		kill(child, SIGKILL);
+		return 1;
+	}
+	find_tracee(&tracees, &ntracees, child)->started = 1;
+	ptrace(PTRACE_CONT, child, NULL, NULL);
+
+	while (ntracees) {
+		struct rusage child_ru;
+		struct tracee *t;
+		int sig, event;
+
+		pid = wait4(-1, &wstatus, __WALL, &child_ru);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("wait4");
+			break;
+		}
+		t = find_tracee(&tracees, &ntracees, pid);
+
+		if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+			if (pid == child) {
+				ru = child_ru;
+				if (WIFSIGNALED(wstatus))
+					result = 128 + WTERMSIG(wstatus);
+				else
+					result = WEXITSTATUS(wstatus);
+			}
+			*t = tracees[--ntracees];
+			continue;
+		}
+		if (!WIFSTOPPED(wstatus))
+			continue;
+
+		sig = WSTOPSIG(wstatus);
+		event = wstatus >> 16;
+		if (sig == SIGTRAP && event == PTRACE_EVENT_SECCOMP) {
+			unsigned long nr;
+
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &nr);
+			/*
+			 * exit and exit_group never come back to an exit stop,
+			 * so they are only counted, with no latency.
+			 */
+			if (nr == 1 || nr == 252) {
+				syscall_slot(stats, nr)->count++;
+				ptrace(PTRACE_CONT, pid, NULL, NULL);
+				continue;
+			}
+			t->nr = nr;
+			t->entry_ns = now_ns();
+			/* Stop once more when the syscall finishes. */
+			ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+			continue;
+		}
+		if (sig == (SIGTRAP | 0x80)) {
+			if (t->nr >= 0)
+				record_syscall(stats, t->nr, now_ns() - t->entry_ns);
+			t->nr = -1;
+			ptrace(PTRACE_CONT, pid, NULL, NULL);
+			continue;
+		}
+		/* Swallow fork/clone/exec events, and new children's initial stop. */
+		if ((sig == SIGTRAP && event) || (sig == SIGSTOP && !t->started))
+			sig = 0;
+		t->started = 1;
+		/* Deliver anything else, staying on the exit stop if mid-syscall. */
+		ptrace(t->nr >= 0 ? PTRACE_SYSCALL : PTRACE_CONT, pid, NULL,
+		       (void *)(long)sig);
+	}
+
+	report_syscalls(stats, now_ns() - start, &ru);
+	free(tracees);
+	free(stats);
+	return result;
+}
+
+/*
+ * Conversion to a static ELF32 executable, so the kernel can load the
+ * program natively (shared page cache, perf symbolization, no copying).
+ * Text and data become PT_LOAD segments at their a.out addresses, with
+ * the same protections map_aout() gives them, and bss is expressed as
+ * data's p_memsz (or its own zero-filesz PT_LOAD when there is no data).
+ *
+ * The kernel lays out an ELF stack as argc, argv[], envp[], but a.out
+ * crt0 expects argc followed by pointers to argv and envp, so the entry
+ * point is a small shim (mapped with the ELF headers, past bss) that
+ * pushes those pointers and jumps to a_entry.
+ */
+#define ELF_PAGE		0x1000
+#define ELF_SHIM_OFFSET		0x100	/* after the ELF and program headers */
+#define ELF_CACHE_VERSION	2
+
+static const unsigned char elf_shim[] = {
+	0x58,				/* pop    %eax			 argc */
+	0x89, 0xe3,			/* mov    %esp,%ebx		 argv */
+	0x8d, 0x4c, 0x83, 0x04,		/* lea    0x4(%ebx,%eax,4),%ecx	 envp */
+	0x51,				/* push   %ecx */
+	0x53,				/* push   %ebx */
+	0x50,				/* push   %eax */
+	0xba, 0, 0, 0, 0,		/* mov    $a_entry,%edx */
+	0xff, 0xe2,			/* jmp    *%edx */
+};
+#define ELF_SHIM_ENTRY		11	/* offset of the a_entry immediate */
+
+static void elf_load(Elf32_Phdr *phdr, Elf32_Off offset, Elf32_Addr vaddr,
+		     Elf32_Word filesz, Elf32_Word memsz, Elf32_Word flags)
+{
+	phdr->p_type = PT_LOAD;
+	phdr->p_offset = offset;
+	phdr->p_vaddr = vaddr;
+	phdr->p_paddr = vaddr;
+	phdr->p_filesz = filesz;
+	phdr->p_memsz = memsz;
+	phdr->p_flags = flags;
+	phdr->p_align = ELF_PAGE;
+}
+
+static int write_elf(int fd, struct aout_image *image, int out, int exec_stack)
+{
+	struct a_out *aout = &image->hdr;
+	unsigned char header[ELF_SHIM_OFFSET + sizeof(elf_shim)] = { };
+	Elf32_Ehdr *ehdr = (Elf32_Ehdr *)header;
+	Elf32_Phdr *phdr = (Elf32_Phdr *)(ehdr + 1);
+	unsigned long text = image->load_addr;
+	unsigned long data = text + aout->a_text;
+	unsigned long shim = ALIGN(data + aout->a_data + aout->a_bss, ELF_PAGE);
+	int n = 0;
+
+	memcpy(header + ELF_SHIM_OFFSET, elf_shim, sizeof(elf_shim));
+	memcpy(header + ELF_SHIM_OFFSET + ELF_SHIM_ENTRY, &aout->a_entry,
+	       sizeof(aout->a_entry));
+
+	if (IS_ALIGNED(aout->a_text, ELF_PAGE)) {
+		if (aout->a_text)
+			elf_load(&phdr[n++], ELF_PAGE, text, aout->a_text,
+				 aout->a_text, PF_R | PF_X);
+		if (aout->a_data + aout->a_bss)
+			elf_load(&phdr[n++], ELF_PAGE + aout->a_text, data,
+				 aout->a_data, aout->a_data + aout->a_bss,
+				 PF_R | PF_W | PF_X);
+	} else {
+		/* Text and data share a page. */
+		elf_load(&phdr[n++], ELF_PAGE, text, aout->a_text + aout->a_data,
+			 aout->a_text + aout->a_data + aout->a_bss,
+			 PF_R | PF_W | PF_X);
+	}
+	elf_load(&phdr[n++], 0, shim, sizeof(header), sizeof(header), PF_R | PF_X);
+	phdr[n].p_type = PT_GNU_STACK;
+	phdr[n].p_flags = PF_R | PF_W | (exec_stack ? PF_X : 0);
+	phdr[n].p_align = 16;
+	n++;
+
+	memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+	ehdr->e_ident[EI_CLASS] = ELFCLASS32;
+	ehdr->e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr->e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr->e_ident[EI_OSABI] = ELFOSABI_SYSV;
+	ehdr->e_type = ET_EXEC;
+	ehdr->e_machine = EM_386;
+	ehdr->e_version = EV_CURRENT;
+	ehdr->e_entry = shim + ELF_SHIM_OFFSET;
+	ehdr->e_phoff = sizeof(*ehdr);
+	ehdr->e_ehsize = sizeof(*ehdr);
+	ehdr->e_phentsize = sizeof(*phdr);
+	ehdr->e_phnum = n;
+
+	if (pwrite(out, header, sizeof(header), 0) != sizeof(header) ||
+	    lseek(out, ELF_PAGE, SEEK_SET) != ELF_PAGE) {
+		perror("write ELF header");
+		return -1;
+	}
+	return copy_text_data(fd, image, out);
+}
+
+/*
+ * SHA-256 of the whole file names the cache entry, so a different
+ * binary can't be mistaken for one converted earlier.
+ */
+#define SHA256_SIZE		32
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const unsigned char *block)
+{
+	uint32_t w[64], v[8], t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+		       (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (; i < 64; i++)
+		w[i] = w[i - 16] + w[i - 7] +
+		       (ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3)) +
+		       (ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10));
+	memcpy(v, state, sizeof(v));
+	for (i = 0; i < 64; i++) {
+		t1 = v[7] + (ROR32(v[4], 6) ^ ROR32(v[4], 11) ^ ROR32(v[4], 25)) +
+		     ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+		t2 = (ROR32(v[0], 2) ^ ROR32(v[0], 13) ^ ROR32(v[0], 22)) +
+		     ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+		memmove(v + 1, v, 7 * sizeof(*v));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+	for (i = 0; i < 8; i++)
+		state[i] += v[i];
+}
+
+static int hash_file(int fd, unsigned char digest[SHA256_SIZE])
+{
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	unsigned char buf[65536 + 128];
+	unsigned long long bits;
+	off_t offset = 0;
+	ssize_t got, done = 0;
+	int i;
+
+	/* Hash whole blocks as they come, carrying any tail over. */
+	while ((got = pread(fd, buf + done, 65536, offset)) > 0) {
+		offset += got;
+		got += done;
+		for (done = 0; got - done >= 64; done += 64)
+			sha256_block(state, buf + done);
+		memmove(buf, buf + done, got - done);
+		done = got - done;
+	}
+	if (got < 0)
+		return -1;
+
+	/* Pad with 0x80, zeros, and the length in bits. */
+	bits = (unsigned long long)offset * 8;
+	buf[done++] = 0x80;
+	while (done % 64 != 56)
+		buf[done++] = 0;
+	for (i = 7; i >= 0; i--)
+		buf[done++] = bits >> (i * 8);
+	for (i = 0; i < done; i += 64)
+		sha256_block(state, buf + i);
+
+	for (i = 0; i < SHA256_SIZE; i++)
+		digest[i] = state[i / 4] >> (24 - (i % 4) * 8);
+	return 0;
+}
+
+static int cache_path(int fd, struct aout_image *image, int exec_stack,
+		      char *path, size_t size)
+{
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	unsigned char digest[SHA256_SIZE];
+	char dir[PATH_MAX], hex[SHA256_SIZE * 2 + 1], *slash;
+	int i;
+
+	if (hash_file(fd, digest) < 0) {
+		perror(image->name);
+		return -1;
+	}
+
+	if (base && *base)
+		snprintf(dir, sizeof(dir), "%s/aout-elf", base);
+	else if (home && *home)
+		snprintf(dir, sizeof(dir), "%s/.cache/aout-elf", home);
+	else {
+		fprintf(stderr, "%s: neither XDG_CACHE_HOME nor HOME is set\n", image->name);
+		return -1;
+	}
+	/* Create the path one component at a time. */
+	for (slash = dir + 1; ; slash++) {
+		char saved = *slash;
+
+		if (saved != '/' && saved != '\0')
+			continue;
+		*slash = '\0';
+		if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+			perror(dir);
+			return -1;
+		}
+		*slash = saved;
+		if (!saved)
+			break;
+	}
+
+	for (i = 0; i < SHA256_SIZE; i++)
+		sprintf(hex + i * 2, "%02x", digest[i]);
+	if (snprintf(path, size, "%s/v%d-%s%s", dir, ELF_CACHE_VERSION, hex,
+		     exec_stack ? "-x" : "") >= size) {
+		fprintf(stderr, "%s: cache path too long\n", dir);
+		return -1;
+	}
+	return 0;
+}
+
+/* Write the ELF under a temporary name and move it into place. */
+static int convert_aout(int fd, struct aout_image *image, const char *path,
+			int exec_stack)
+{
+	char tmp[PATH_MAX];
+	int out;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, getpid()) >= sizeof(tmp)) {
+		fprintf(stderr, "%s: cache path too long\n", path);
+		return -1;
+	}
+	out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (out < 0) {
+		perror(tmp);
+		return -1;
+	}
+	if (write_elf(fd, image, out, exec_stack) < 0 || close(out) < 0 ||
+	    rename(tmp, path) < 0) {
+		perror(path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+static int write_elf_file(int fd, struct aout_image *image, const char *path,
+			  int exec_stack)
+{
+	int out;
+
+	out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (out < 0) {
+		perror(path);
+		return 1;
+	}
+	if (write_elf(fd, image, out, exec_stack) < 0 || close(out) < 0) {
+		perror(path);
+		return 1;
+	}
+	return 0;
+}
+
+static int run_native(int fd, struct aout_image *image, char *argv[],
+		      char *envp[], int exec_stack)
+{
+	char path[PATH_MAX];
+
+	if (cache_path(fd, image, exec_stack, path, sizeof(path)) < 0)
+		return 1;
+	if (access(path, X_OK) < 0 &&
+	    convert_aout(fd, image, path, exec_stack) < 0)
+		return 1;
+	close(fd);
+
+	execve(path, argv, envp);
+	perror(path);
+	check_mmap_min_addr(image->load_addr, image->file_type);
+	return 1;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--exec-stack] [--profile PREFIX [--profile-hz HZ]] a.out [arg ...]\n",
+		argv0);
+	fprintf(stderr, "       %s [--exec-stack] --trace a.out [arg ...]\n", argv0);
+	fprintf(stderr, "       %s [--exec-stack] --batch LIST\n", argv0);
+	fprintf(stderr, "       %s [--exec-stack] --native a.out [arg ...]\n", argv0);
+	fprintf(stderr, "       %s [--exec-stack] --elf OUTPUT a.out\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char *argv[], char *envp[])
+{
+	static const struct option options[] = {
+		{ "exec-stack",	no_argument,		NULL, 'x' },
+		{ "batch",	required_argument,	NULL, 'b' },
+		{ "profile",	required_argument,	NULL, 'p' },
+		{ "profile-hz",	required_argument,	NULL, 'z' },
+		{ "trace",	no_argument,		NULL, 't' },
+		{ "native",	no_argument,		NULL, 'n' },
+		{ "elf",	required_argument,	NULL, 'e' },
+		{ }
+	};
+	struct aout_image image;
+	const char *batch = NULL, *profile = NULL, *elf = NULL;
+	int profile_hz = PROFILE_HZ;
+	int exec_stack = 0, trace = 0, native = 0;
+	int pagesize;
+	int fd, opt;
+
+	if (sizeof(void *) != 4) {
+		fprintf(stderr, "Eek: I was compiled in 64-bit mode. Please build with -m32.\n");
+		return 1;
+	}
+
+	/* Stop at the a.out name: everything after it belongs to the program. */
+	while ((opt = getopt_long(argc, argv, "+", options, NULL)) != -1) {
+		switch (opt) {
+		case 'x':
+			exec_stack = 1;
+			break;
+		case 'b':
+			batch = optarg;
+			break;
+		case 'p':
+			profile = optarg;
+			break;
+		case 't':
+			trace = 1;
+			break;
+		case 'n':
+			native = 1;
+			break;
+		case 'e':
+			elf = optarg;
+			break;
+		case 'z':
+			profile_hz = atoi(optarg);
+			if (profile_hz < 1 || profile_hz > 1000000)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	pagesize = getpagesize();
+
+	if (batch) {
+		if (optind != argc || profile || trace || native || elf)
+			usage(argv[0]);
+		return run_batch(batch, envp, pagesize, exec_stack);
+	}
+
+	if (optind >= argc || (!!profile + trace + native + !!elf) > 1)
+		usage(argv[0]);
+	if (elf && optind + 1 != argc)
+		usage(argv[0]);
+	/* do not include our own argv[0] or options */
+	argc -= optind;
+	argv += optind;
+
+	fd = open(argv[0], O_RDONLY);
+	if (fd < 0) {
+		perror(argv[0]);
+		return 1;
+	}
+
+	if (parse_aout(fd, argv[0], &image, profile != NULL) < 0)
+		return 1;
+
+	if (elf)
+		return write_elf_file(fd, &image, elf, exec_stack);
+	if (native)
+		return run_native(fd, &image, argv, envp, exec_stack);
+	if (trace)
+		return run_traced(fd, &image, argc, argv, envp, pagesize, exec_stack);
+	if (profile)
+		return run_profiled(fd, &image, argc, argv, envp, pagesize,
+				    exec_stack, profile, profile_hz);
+
+	if (map_aout(fd, &image, pagesize) < 0)
+		return 1;
+	/* The mappings hold their own reference to the file. */
+	close(fd);
+
+	start_aout(&image, argc, argv, envp, pagesize, exec_stack);
 	return 2;
 }
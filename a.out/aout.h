@@ -0,0 +1,67 @@
+/*
+ * Shared a.out definitions for the loader and its test tools.
+ * License: GPLv2
+ */
+#ifndef AOUT_H
+#define AOUT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Locally define the stuff from a.out.h since that file may disappear. */
+struct a_out
+{
+	unsigned int a_info;	/* machine type, magic, etc */
+	unsigned int a_text;	/* text size */
+	unsigned int a_data;	/* data size */
+	unsigned int a_bss;	/* desired bss size */
+	unsigned int a_syms;	/* symbol table size */
+	unsigned int a_entry;	/* entry address */
+	unsigned int a_trsize;	/* text relocation size */
+	unsigned int a_drsize;	/* data relocation size */
+};
+
+#define Q_MAGIC_MAGIC		(0x006400ccUL)
+#define Q_MAGIC_TXT_FDOFF	0x0000
+#define Q_MAGIC_LOAD_ADDR	0x1000
+
+#define Z_MAGIC_MAGIC		(0x0064010bUL)
+#define Z_MAGIC_TXT_FDOFF	0x0400
+#define Z_MAGIC_LOAD_ADDR	0x0000
+
+#define MMAP_MIN_ADDR_PATH	"/proc/sys/vm/mmap_min_addr"
+
+#define ALIGN(x, a)		ALIGN_MASK(x, (unsigned long)(a) - 1)
+#define ALIGN_MASK(x, mask)	(typeof(x))(((unsigned long)(x) + (mask)) & ~(mask))
+#define IS_ALIGNED(x, a)	(((unsigned long)(x) & ((unsigned long)(a) - 1)) == 0)
+
+/*
+ * Returns 0 if the load address is mappable (or mmap_min_addr can't be
+ * read), otherwise explains how to change it and returns -1.
+ */
+static inline int check_mmap_min_addr(unsigned long load_addr, const char *name)
+{
+	unsigned long addr;
+	char buf[128], *result;
+	FILE *proc;
+
+	proc = fopen(MMAP_MIN_ADDR_PATH, "r");
+	if (!proc)
+		return 0;
+	result = fgets(buf, sizeof(buf), proc);
+	fclose(proc);
+	if (!result)
+		return 0;
+
+	addr = strtoul(result, NULL, 0);
+	if (addr <= load_addr)
+		return 0;
+
+	fprintf(stderr, "%s is set to %lu but this %s a.out binary must be mapped at %lu.\n",
+		MMAP_MIN_ADDR_PATH, addr, name, load_addr);
+	fprintf(stderr, "To temporarily change this, run: sudo sysctl -w vm.mmap_min_addr=%lu\n",
+		load_addr);
+	return -1;
+}
+
+#endif /* AOUT_H */
@@ -0,0 +1,164 @@
+/*
+ * Generate a synthetic static ia32 a.out binary for exercising the
+ * loader: text of the requested size starting with a stub that calls
+ * _exit(0), data filled with a non-zero pattern, and the requested bss.
+ * License: GPLv2
+ *
+ * Usage: mkaout [-z] [-t TEXT] [-d DATA] [-b BSS] OUTPUT
+ *
+ * Sizes take an optional k or m suffix. QMAGIC is the default; -z
+ * writes ZMAGIC instead. Text is rounded up to whole pages so the data
+ * segment starts on a page boundary, like the real linkers did.
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aout.h"
+
+#define PAGE_SIZE	0x1000
+
+/* movl $1, %eax; xorl %ebx, %ebx; int $0x80 */
+static const unsigned char exit_stub[] = {
+	0xb8, 0x01, 0x00, 0x00, 0x00,
+	0x31, 0xdb,
+	0xcd, 0x80,
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-z] [-t TEXT] [-d DATA] [-b BSS] OUTPUT\n", argv0);
+	exit(2);
+}
+
+static unsigned int parse_size(const char *arg, const char *argv0)
+{
+	unsigned long long size;
+	char *end;
+
+	size = strtoull(arg, &end, 0);
+	switch (*end) {
+	case 'k': case 'K':
+		size <<= 10;
+		end++;
+		break;
+	case 'm': case 'M':
+		size <<= 20;
+		end++;
+		break;
+	}
+	if (end == arg || *end || size > 0x7fffffffULL)
+		usage(argv0);
+	return size;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+
+	while (len) {
+		ssize_t done = write(fd, p, len);
+
+		if (done < 0)
+			return -1;
+		p += done;
+		len -= done;
+	}
+	return 0;
+}
+
+/* Write "len" bytes: the prefix, then "byte" for the rest. */
+static int write_fill(int fd, const void *prefix, size_t prefix_len,
+		      unsigned char byte, size_t len)
+{
+	unsigned char buf[PAGE_SIZE];
+	size_t chunk;
+
+	memset(buf, byte, sizeof(buf));
+	if (write_all(fd, prefix, prefix_len) < 0)
+		return -1;
+	len -= prefix_len;
+	for (; len; len -= chunk) {
+		chunk = len < sizeof(buf) ? len : sizeof(buf);
+		if (write_all(fd, buf, chunk) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int text = PAGE_SIZE, data = PAGE_SIZE, bss = PAGE_SIZE;
+	unsigned char prefix[sizeof(struct a_out) + sizeof(exit_stub)];
+	struct a_out aout = { };
+	size_t code_off;
+	int zmagic = 0;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "zt:d:b:")) != -1) {
+		switch (opt) {
+		case 'z':
+			zmagic = 1;
+			break;
+		case 't':
+			text = parse_size(optarg, argv[0]);
+			break;
+		case 'd':
+			data = parse_size(optarg, argv[0]);
+			break;
+		case 'b':
+			bss = parse_size(optarg, argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind + 1 != argc)
+		usage(argv[0]);
+
+	/*
+	 * QMAGIC's header is the start of its first text page, so the code
+	 * follows it. ZMAGIC's header sits in its own block before text.
+	 */
+	code_off = zmagic ? 0 : sizeof(aout);
+	text = ALIGN(text ? text : 1, PAGE_SIZE);
+
+	aout.a_info = zmagic ? Z_MAGIC_MAGIC : Q_MAGIC_MAGIC;
+	aout.a_text = text;
+	aout.a_data = data;
+	aout.a_bss = bss;
+	aout.a_entry = (zmagic ? Z_MAGIC_LOAD_ADDR : Q_MAGIC_LOAD_ADDR) + code_off;
+
+	fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0755);
+	if (fd < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (zmagic) {
+		unsigned char block[Z_MAGIC_TXT_FDOFF] = { };
+
+		memcpy(block, &aout, sizeof(aout));
+		if (write_all(fd, block, sizeof(block)) < 0)
+			goto fail;
+	} else {
+		memcpy(prefix, &aout, sizeof(aout));
+	}
+	memcpy(prefix + code_off, exit_stub, sizeof(exit_stub));
+
+	/* Pad text with int3, and fill data with a non-zero pattern. */
+	if (write_fill(fd, prefix, code_off + sizeof(exit_stub), 0xcc, text) < 0 ||
+	    write_fill(fd, NULL, 0, 0x5a, data) < 0)
+		goto fail;
+
+	if (close(fd) < 0)
+		goto fail;
+	return 0;
+
+fail:
+	perror(argv[optind]);
+	return 1;
+}
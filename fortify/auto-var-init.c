@@ -0,0 +1,294 @@
+/*
+ * Check -ftrivial-auto-var-init=zero/pattern behavior, and measure how
+ * much the automatic initialization costs for stack buffers of various
+ * sizes, compared to the same function opting out via
+ * __attribute__((uninitialized)). See Makefile for build flags: this is
+ * built once per mode as auto-var-init-zero and auto-var-init-pattern.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "bench.h"
+
+typedef unsigned char	    u8;
+typedef unsigned int	   u32;
+typedef unsigned long long u64;
+
+#define noinline __attribute__((__noinline__))
+#define __uninitialized __attribute__((__uninitialized__))
+
+/* Make sure "ptr" is not elided by the compiler. */
+#define barrier_data(ptr) __asm__ __volatile__("": :"r"(ptr) :"memory")
+
+#if defined(AUTO_VAR_INIT_zero)
+# define INIT_BYTE	0x00
+# define INIT_MODE	"zero"
+#elif defined(AUTO_VAR_INIT_pattern)
+# ifdef __clang__
+#  define INIT_BYTE	0xAA
+# else
+#  define INIT_BYTE	0xFE
+# endif
+# define INIT_MODE	"pattern"
+#else
+# error "Build with -ftrivial-auto-var-init=MODE -DAUTO_VAR_INIT_MODE"
+#endif
+
+/* What the stack is scribbled with before looking at uninitialized locals. */
+#define STACK_DIRT	0x5A
+#define PROBE_BYTES	256
+
+/* Overhead (percent of an opted-out call) that marks the break-even size. */
+#ifndef BREAK_EVEN_PERCENT
+# define BREAK_EVEN_PERCENT	10
+#endif
+/* Repetitions per buffer size; the median overhead is used. */
+#ifndef BREAK_EVEN_REPS
+# define BREAK_EVEN_REPS	5
+#endif
+
+/* Used to stop optimizer from seeing constant expressions. */
+volatile int unconst = 0;
+
+/*
+ * Leave a known pattern in the stack region the following call at the
+ * same depth will use, so that "initialized" is distinguishable from
+ * "happened to be fresh (zeroed) stack pages".
+ */
+static noinline void dirty_stack(void)
+{
+	u8 buf[PROBE_BYTES * 4] __uninitialized;
+
+	memset(buf, STACK_DIRT, sizeof(buf));
+	barrier_data(buf);
+}
+
+static noinline void read_uninit_array(u8 *out)
+{
+	u8 buf[PROBE_BYTES];
+
+	barrier_data(buf);
+	memcpy(out, buf, sizeof(buf));
+}
+
+static noinline void read_optout_array(u8 *out)
+{
+	u8 buf[PROBE_BYTES] __uninitialized;
+
+	barrier_data(buf);
+	memcpy(out, buf, sizeof(buf));
+}
+
+static noinline u32 read_uninit_u32(void)
+{
+	u32 value;
+
+	barrier_data(&value);
+	return value;
+}
+
+static noinline void *read_uninit_ptr(void)
+{
+	void *value;
+
+	barrier_data(&value);
+	return value;
+}
+
+struct padded {
+	u8 small;
+	/* padding up to the alignment of "big" */
+	u64 big;
+};
+
+static noinline void read_uninit_struct(u8 *out)
+{
+	struct padded value;
+
+	barrier_data(&value);
+	memcpy(out, &value, sizeof(value));
+}
+
+static size_t count_not(const u8 *buf, size_t len, u8 byte)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < len; i++)
+		if (buf[i] != byte)
+			count++;
+	return count;
+}
+
+TEST(array_filled)
+{
+	u8 seen[PROBE_BYTES];
+
+	dirty_stack();
+	read_uninit_array(seen);
+	EXPECT_EQ(0, count_not(seen, sizeof(seen), INIT_BYTE)) {
+		TH_LOG("expected every byte to be 0x%02x (" INIT_MODE "), saw 0x%02x first",
+		       INIT_BYTE, seen[0]);
+	}
+}
+
+TEST(scalar_filled)
+{
+	u32 value;
+	void *ptr;
+	u8 expected[sizeof(ptr)];
+
+	memset(expected, INIT_BYTE, sizeof(expected));
+
+	dirty_stack();
+	value = read_uninit_u32();
+	EXPECT_EQ(0, count_not((u8 *)&value, sizeof(value), INIT_BYTE)) {
+		TH_LOG("u32 was 0x%08x", value);
+	}
+
+	dirty_stack();
+	ptr = read_uninit_ptr();
+	EXPECT_EQ(0, memcmp(&ptr, expected, sizeof(ptr))) {
+		TH_LOG("pointer was %p", ptr);
+	}
+}
+
+/*
+ * Members get the init pattern. GCC documents padding as always zeroed
+ * (even in pattern mode), so for padding just make sure nothing stale
+ * from the stack shows through.
+ */
+TEST(struct_padding_filled)
+{
+	u8 seen[sizeof(struct padded)];
+	size_t pad_start = offsetof(struct padded, small) + sizeof(((struct padded *)0)->small);
+	size_t pad_end = offsetof(struct padded, big);
+	size_t i;
+
+	dirty_stack();
+	read_uninit_struct(seen);
+	EXPECT_EQ(INIT_BYTE, seen[offsetof(struct padded, small)]);
+	EXPECT_EQ(0, count_not(&seen[pad_end], sizeof(seen) - pad_end, INIT_BYTE));
+	for (i = pad_start; i < pad_end; i++) {
+		EXPECT_TRUE(seen[i] == INIT_BYTE || seen[i] == 0) {
+			TH_LOG("padding byte %zu was 0x%02x", i, seen[i]);
+		}
+	}
+}
+
+/*
+ * With the opt-out, the buffer should contain whatever the stack held.
+ * Whether that is exactly our dirt depends on the compiler laying out
+ * both frames the same way, so only a full init pattern is a failure.
+ */
+TEST(uninitialized_attribute_opts_out)
+{
+	u8 seen[PROBE_BYTES];
+
+	dirty_stack();
+	read_optout_array(seen);
+	EXPECT_NE(0, count_not(seen, sizeof(seen), INIT_BYTE)) {
+		TH_LOG("__attribute__((uninitialized)) buffer was still initialized");
+	}
+	if (count_not(seen, sizeof(seen), STACK_DIRT) != 0)
+		XFAIL(return, "stack slot was not reused, cannot see prior contents");
+}
+
+/*
+ * A typical hot function: a large stack buffer of which only a small
+ * header is actually written before being handed to something else.
+ */
+#define STACK_USER(size)						\
+static noinline u8 stack_user_##size(u32 seed)				\
+{									\
+	u8 buf[size];							\
+									\
+	memset(buf, seed, 64);						\
+	barrier_data(buf);						\
+	return buf[seed & 63];						\
+}									\
+static noinline u8 stack_user_optout_##size(u32 seed)			\
+{									\
+	u8 buf[size] __uninitialized;					\
+									\
+	memset(buf, seed, 64);						\
+	barrier_data(buf);						\
+	return buf[seed & 63];						\
+}
+
+STACK_USER(64)
+STACK_USER(128)
+STACK_USER(256)
+STACK_USER(512)
+STACK_USER(1024)
+STACK_USER(4096)
+STACK_USER(16384)
+
+static int compare_double(const void *a, const void *b)
+{
+	double left = *(const double *)a, right = *(const double *)b;
+
+	return left < right ? -1 : left > right;
+}
+
+static double median(double *values, int count)
+{
+	qsort(values, count, sizeof(*values), compare_double);
+	return values[count / 2];
+}
+
+/*
+ * A single timing pass is too noisy to place a threshold on, so each
+ * size is measured several times (alternating the two variants), and
+ * the break-even point is the first of two consecutive sizes whose
+ * median overhead is over the threshold.
+ */
+TEST(stack_buffer_init_cost)
+{
+	unsigned long iters = bench_iters(200000);
+	size_t break_even = 0, over = 0;
+	volatile u8 sink;
+
+#define MEASURE(size)	do {						\
+	double init[BREAK_EVEN_REPS], optout[BREAK_EVEN_REPS];		\
+	double percent[BREAK_EVEN_REPS], overhead;			\
+									\
+	for (int rep = 0; rep < BREAK_EVEN_REPS; rep++) {		\
+		init[rep] = BENCH_NS_PER_OP(iters, sink = stack_user_##size(__i + unconst)); \
+		optout[rep] = BENCH_NS_PER_OP(iters, sink = stack_user_optout_##size(__i + unconst)); \
+		percent[rep] = optout[rep] > 0 ?			\
+			(init[rep] - optout[rep]) * 100.0 / optout[rep] : 0.0; \
+	}								\
+	overhead = median(percent, BREAK_EVEN_REPS);			\
+	TH_LOG("%6d bytes: %8.2fns " INIT_MODE ", %8.2fns opt-out, median %+6.1f%%", \
+	       size, median(init, BREAK_EVEN_REPS),			\
+	       median(optout, BREAK_EVEN_REPS), overhead);		\
+	if (overhead > BREAK_EVEN_PERCENT) {				\
+		if (!break_even && over)				\
+			break_even = over;				\
+		over = size;						\
+	} else {							\
+		over = 0;						\
+	}								\
+} while (0)
+
+	MEASURE(64);
+	MEASURE(128);
+	MEASURE(256);
+	MEASURE(512);
+	MEASURE(1024);
+	MEASURE(4096);
+	MEASURE(16384);
+#undef MEASURE
+	(void)sink;
+
+	if (break_even)
+		TH_LOG("opting out pays off (>%d%% overhead) from %zu byte buffers",
+		       BREAK_EVEN_PERCENT, break_even);
+	else
+		TH_LOG("no buffer size exceeded %d%% overhead", BREAK_EVEN_PERCENT);
+}
+
+TEST_HARNESS_MAIN
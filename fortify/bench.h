@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * bench.h: tiny timing helpers shared by the fortify benchmarks.
+ *
+ * Each measurement runs the body BENCH_ROUNDS times and keeps the
+ * fastest round, which is far more stable across runs than the mean
+ * when a machine is otherwise busy.
+ */
+#ifndef __FORTIFY_BENCH_H
+#define __FORTIFY_BENCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef BENCH_ROUNDS
+# define BENCH_ROUNDS	5
+#endif
+
+/* Make sure "ptr" is not elided by the compiler. */
+#define bench_barrier_data(ptr) __asm__ __volatile__("": :"r"(ptr) :"memory")
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Run "body" for "iters" iterations, BENCH_ROUNDS times, and evaluate
+ * to the best observed cost per iteration in nanoseconds (as a double).
+ */
+#define BENCH_NS_PER_OP(iters, body) ({				\
+	double __best = 0.0;					\
+	unsigned long __iters = (iters);			\
+	for (int __round = 0; __round < BENCH_ROUNDS; __round++) { \
+		uint64_t __start = bench_now_ns();		\
+		for (unsigned long __i = 0; __i < __iters; __i++) { \
+			body;					\
+		}						\
+		double __ns = (double)(bench_now_ns() - __start) / __iters; \
+		if (__round == 0 || __ns < __best)		\
+			__best = __ns;				\
+	}							\
+	__best;							\
+})
+
+/* Allow iteration counts to be scaled from the environment. */
+static inline unsigned long bench_iters(unsigned long dflt)
+{
+	const char *scale = getenv("BENCH_SCALE");
+	double factor;
+
+	if (!scale)
+		return dflt;
+	factor = strtod(scale, NULL);
+	if (factor <= 0)
+		return dflt;
+	return (unsigned long)(dflt * factor) ?: 1;
+}
+
+#endif /* __FORTIFY_BENCH_H */
@@ -0,0 +1,182 @@
+/*
+ * Check that Clang's -fsanitize=cfi-icall traps on indirect calls through
+ * a function pointer of the wrong type, and measure what the checks cost
+ * when dispatching through ops tables of various sizes. Clang only; see
+ * Makefile for build flags (this needs LTO).
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "bench.h"
+
+typedef unsigned int	   u32;
+typedef unsigned long long u64;
+
+#define noinline __attribute__((__noinline__))
+#define __nocfi __attribute__((no_sanitize("cfi-icall")))
+
+/* Used to stop optimizer from seeing constant expressions. */
+volatile int unconst = 0;
+
+/* Kernel-ish ops structure. */
+struct widget_ops {
+	int (*open)(int flags);
+	long (*ioctl)(int cmd, unsigned long arg);
+};
+
+static noinline int widget_open(int flags)
+{
+	return flags | 1;
+}
+
+static noinline long widget_ioctl(int cmd, unsigned long arg)
+{
+	return cmd + (long)(arg & 0xff);
+}
+
+/* Same arity as .open, but a different prototype. */
+static noinline long widget_open_wrong(long flags)
+{
+	return flags | 2;
+}
+
+/* Different arity entirely. */
+static noinline int widget_ioctl_wrong(int cmd)
+{
+	return cmd;
+}
+
+/* Hide the assignments from the optimizer so the calls stay indirect. */
+static struct widget_ops * volatile active_ops;
+
+static struct widget_ops good_ops = {
+	.open = widget_open,
+	.ioctl = widget_ioctl,
+};
+
+static struct widget_ops bad_open_ops = {
+	.open = (int (*)(int))(void *)widget_open_wrong,
+	.ioctl = widget_ioctl,
+};
+
+static struct widget_ops bad_ioctl_ops = {
+	.open = widget_open,
+	.ioctl = (long (*)(int, unsigned long))(void *)widget_ioctl_wrong,
+};
+
+TEST(matching_indirect_calls_survive)
+{
+	active_ops = &good_ops;
+	EXPECT_EQ(1, active_ops->open(0 + unconst));
+	EXPECT_EQ(5, active_ops->ioctl(4 + unconst, 0x101));
+}
+
+TEST_SIGNAL(mismatched_prototype_traps, SIGILL)
+{
+	int ret;
+
+	active_ops = &bad_open_ops;
+	ret = active_ops->open(unconst);
+	TH_LOG("this should have been unreachable (got %d)", ret);
+}
+
+TEST_SIGNAL(mismatched_arity_traps, SIGILL)
+{
+	long ret;
+
+	active_ops = &bad_ioctl_ops;
+	ret = active_ops->ioctl(unconst, 0);
+	TH_LOG("this should have been unreachable (got %ld)", ret);
+}
+
+/* Opting out with no_sanitize should skip the check entirely. */
+static noinline __nocfi int call_open_unchecked(struct widget_ops *ops, int flags)
+{
+	return ops->open(flags);
+}
+
+TEST(mismatched_call_survives_nocfi)
+{
+	active_ops = &bad_open_ops;
+	EXPECT_EQ(2, call_open_unchecked(active_ops, unconst));
+}
+
+/*
+ * Dispatch benchmark: a table of distinct handlers of one type, called
+ * in an unpredictable order, like a hot ops table lookup.
+ */
+typedef u64 (*handler_t)(u64 value);
+
+#define HANDLER(n)						\
+static noinline u64 handler_##n(u64 value)			\
+{								\
+	return (value >> 1) ^ (n * 0x9E3779B97F4A7C15ULL);	\
+}
+#define HANDLERS8(n)						\
+	HANDLER(n##0) HANDLER(n##1) HANDLER(n##2) HANDLER(n##3)	\
+	HANDLER(n##4) HANDLER(n##5) HANDLER(n##6) HANDLER(n##7)
+HANDLERS8(1) HANDLERS8(2) HANDLERS8(3) HANDLERS8(4)
+HANDLERS8(5) HANDLERS8(6) HANDLERS8(7) HANDLERS8(8)
+
+#define REF8(n)							\
+	handler_##n##0, handler_##n##1, handler_##n##2, handler_##n##3, \
+	handler_##n##4, handler_##n##5, handler_##n##6, handler_##n##7
+static handler_t handlers[] = {
+	REF8(1), REF8(2), REF8(3), REF8(4),
+	REF8(5), REF8(6), REF8(7), REF8(8),
+};
+
+#define MAX_OPS		(sizeof(handlers) / sizeof(*handlers))
+#define SEQUENCE	4096
+
+struct ops_table {
+	u32 count;
+	handler_t ops[MAX_OPS];
+};
+
+static struct ops_table table;
+static u32 sequence[SEQUENCE];
+
+static noinline u64 dispatch(const struct ops_table *t, u64 value, unsigned long i)
+{
+	return t->ops[sequence[i % SEQUENCE] % t->count](value);
+}
+
+static noinline __nocfi u64 dispatch_nocfi(const struct ops_table *t, u64 value, unsigned long i)
+{
+	return t->ops[sequence[i % SEQUENCE] % t->count](value);
+}
+
+TEST(ops_table_dispatch_cost)
+{
+	unsigned long iters = bench_iters(2000000);
+	static const u32 sizes[] = { 1, 4, 16, 64 };
+	u32 state = 0x12345678;
+	u64 value = 1;
+	size_t i;
+
+	for (i = 0; i < SEQUENCE; i++) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		sequence[i] = state;
+	}
+
+	for (i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		double checked, unchecked;
+
+		table.count = sizes[i];
+		memcpy(table.ops, handlers, sizes[i] * sizeof(*handlers));
+
+		checked = BENCH_NS_PER_OP(iters, value = dispatch(&table, value, __i));
+		unchecked = BENCH_NS_PER_OP(iters, value = dispatch_nocfi(&table, value, __i));
+		TH_LOG("%3u ops: %6.2fns cfi-icall, %6.2fns unchecked, %+6.2fns (%+5.1f%%)",
+		       sizes[i], checked, unchecked, checked - unchecked,
+		       unchecked > 0 ? (checked - unchecked) * 100.0 / unchecked : 0.0);
+	}
+	bench_barrier_data(&value);
+}
+
+TEST_HARNESS_MAIN
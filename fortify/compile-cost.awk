@@ -0,0 +1,48 @@
+# Format compile-cost rows (compiler, group, source, wall-ms, maxrss-KiB,
+# object-bytes, status) into a table, with each flag group's cost shown
+# relative to the "none" group for the same compiler and source.
+{
+	key = $1 SUBSEP $3
+	if (!(key in seen)) {
+		seen[key] = 1
+		order[++rows] = key
+	}
+	if (!($2 in group_seen)) {
+		group_seen[$2] = 1
+		group[++groups] = $2
+	}
+	wall[key, $2] = $4
+	rss[key, $2] = $5
+	size[key, $2] = $6
+	status[key, $2] = $7
+}
+
+function ratio(value, base) {
+	if (value == "-" || base == "-" || base == 0)
+		return "     -"
+	return sprintf("%5.2fx", value / base)
+}
+
+END {
+	printf("%-8s %-24s %-8s %10s %7s %10s %7s %10s %7s\n", "compiler", "source",
+	       "group", "wall(ms)", "", "rss(KiB)", "", "obj(B)", "")
+	for (r = 1; r <= rows; r++) {
+		split(order[r], parts, SUBSEP)
+		for (g = 1; g <= groups; g++) {
+			k = order[r] SUBSEP group[g]
+			if (!(k in status))
+				continue
+			if (status[k] != "ok") {
+				printf("%-8s %-24s %-8s %s\n", parts[1], parts[2],
+				       group[g], status[k])
+				continue
+			}
+			b = order[r] SUBSEP "none"
+			printf("%-8s %-24s %-8s %10s %7s %10s %7s %10s %7s\n",
+			       parts[1], parts[2], group[g],
+			       wall[k], ratio(wall[k], wall[b]),
+			       rss[k], ratio(rss[k], rss[b]),
+			       size[k], ratio(size[k], size[b]))
+		}
+	}
+}
@@ -0,0 +1,149 @@
+/*
+ * Measure what a single compiler invocation costs: wall time, peak RSS
+ * (via wait4(), which includes the cc1/as children the driver waited
+ * for), and the size of the resulting object. Prints one tab-separated
+ * row per invocation, prefixed with the given labels:
+ *
+ *	LABEL... <TAB> wall-ms <TAB> maxrss-KiB <TAB> object-bytes <TAB> status
+ *
+ * See the "compile-cost" target in the Makefile, which runs this across
+ * compilers, flag groups, and translation units and builds a table.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [-r REPEAT] [-o OBJECT] [-v] LABEL... -- COMMAND [ARG...]\n",
+		argv0);
+	exit(2);
+}
+
+/* Run the command once, returning its wait status (or -1). */
+static int measure(char *cmd[], int verbose, uint64_t *wall_ns, long *maxrss)
+{
+	struct rusage ru;
+	uint64_t start;
+	int status;
+	pid_t pid;
+
+	start = bench_now_ns();
+	pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		return -1;
+	}
+	if (pid == 0) {
+		if (!verbose) {
+			int null = open("/dev/null", O_WRONLY);
+
+			if (null >= 0) {
+				dup2(null, STDOUT_FILENO);
+				dup2(null, STDERR_FILENO);
+				close(null);
+			}
+		}
+		execvp(cmd[0], cmd);
+		_exit(127);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0) {
+		perror("wait4");
+		return -1;
+	}
+	*wall_ns = bench_now_ns() - start;
+	*maxrss = ru.ru_maxrss;
+
+	return status;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *object = NULL;
+	int repeat = 3, verbose = 0;
+	uint64_t best_ns = 0;
+	long peak_rss = 0;
+	long long bytes = -1;
+	char status[32] = "ok";
+	int opt, i, labels;
+
+	while ((opt = getopt(argc, argv, "+r:o:v")) != -1) {
+		switch (opt) {
+		case 'r':
+			repeat = atoi(optarg);
+			if (repeat < 1)
+				usage(argv[0]);
+			break;
+		case 'o':
+			object = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Labels run up to "--", the command follows it. */
+	for (labels = optind; labels < argc; labels++)
+		if (strcmp(argv[labels], "--") == 0)
+			break;
+	if (labels == optind || labels + 1 >= argc)
+		usage(argv[0]);
+
+	for (i = 0; i < repeat; i++) {
+		uint64_t ns;
+		long rss;
+		int ret;
+
+		if (object)
+			unlink(object);
+		ret = measure(&argv[labels + 1], verbose, &ns, &rss);
+		if (ret == -1) {
+			snprintf(status, sizeof(status), "error");
+			break;
+		}
+		if (WIFSIGNALED(ret)) {
+			snprintf(status, sizeof(status), "signal(%d)", WTERMSIG(ret));
+			break;
+		}
+		if (WEXITSTATUS(ret) != 0) {
+			snprintf(status, sizeof(status), "failed(%d)", WEXITSTATUS(ret));
+			break;
+		}
+		/* Keep the fastest run, and the largest footprint. */
+		if (i == 0 || ns < best_ns)
+			best_ns = ns;
+		if (rss > peak_rss)
+			peak_rss = rss;
+	}
+
+	if (object && strcmp(status, "ok") == 0) {
+		struct stat info;
+
+		if (stat(object, &info) == 0)
+			bytes = info.st_size;
+		unlink(object);
+	}
+
+	for (i = optind; i < labels; i++)
+		printf("%s\t", argv[i]);
+	if (strcmp(status, "ok") == 0)
+		printf("%.1f\t%ld\t%lld\t%s\n", best_ns / 1e6, peak_rss, bytes, status);
+	else
+		printf("-\t-\t-\t%s\n", status);
+
+	return 0;
+}
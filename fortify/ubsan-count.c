@@ -0,0 +1,234 @@
+/*
+ * Minimal UBSAN runtime that counts hits per source location instead of
+ * trapping, so a whole workload can be surveyed for how often each
+ * overflow or bounds check fires. Link this into objects built with the
+ * sanitizers in recover mode (-fsanitize-recover=all) and without any
+ * trap flags; see the "*-count" targets in the Makefile.
+ *
+ * The counters live in a shared anonymous mapping created before main(),
+ * so hits from forked children (e.g. every harness.h test) are folded
+ * into the same table, and the process that created the table prints
+ * a sorted report at exit. Note that since nothing traps, TEST_SIGNAL()
+ * expectations will report failures in this mode: the report is the
+ * interesting output.
+ *
+ * Every handler's data argument starts with a struct source_location,
+ * and that data is unique per check site, so its address is used as the
+ * key into a lock-free open-addressed table. The hot path is a hash, a
+ * load, a compare, and a relaxed atomic increment.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef unsigned int	   u32;
+typedef unsigned long long u64;
+
+#define UBSAN_COUNT_SLOTS	4096	/* must be a power of 2 */
+
+struct source_location {
+	const char *file_name;
+	u32 line;
+	u32 column;
+};
+
+enum ubsan_kind {
+	KIND_OUT_OF_BOUNDS,
+	KIND_TYPE_MISMATCH,
+	KIND_ADD_OVERFLOW,
+	KIND_SUB_OVERFLOW,
+	KIND_MUL_OVERFLOW,
+	KIND_NEGATE_OVERFLOW,
+	KIND_DIVREM_OVERFLOW,
+	KIND_POINTER_OVERFLOW,
+	KIND_IMPLICIT_CONVERSION,
+	KIND_SHIFT_OUT_OF_BOUNDS,
+	KIND_LOAD_INVALID_VALUE,
+	KIND_VLA_BOUND_NOT_POSITIVE,
+	KIND_INVALID_BUILTIN,
+	KIND_BUILTIN_UNREACHABLE,
+	KIND_MISSING_RETURN,
+};
+
+static const char * const kind_names[] = {
+	[KIND_OUT_OF_BOUNDS]		= "out-of-bounds",
+	[KIND_TYPE_MISMATCH]		= "type-mismatch",
+	[KIND_ADD_OVERFLOW]		= "add-overflow",
+	[KIND_SUB_OVERFLOW]		= "sub-overflow",
+	[KIND_MUL_OVERFLOW]		= "mul-overflow",
+	[KIND_NEGATE_OVERFLOW]		= "negate-overflow",
+	[KIND_DIVREM_OVERFLOW]		= "divrem-overflow",
+	[KIND_POINTER_OVERFLOW]		= "pointer-overflow",
+	[KIND_IMPLICIT_CONVERSION]	= "implicit-conversion",
+	[KIND_SHIFT_OUT_OF_BOUNDS]	= "shift-out-of-bounds",
+	[KIND_LOAD_INVALID_VALUE]	= "load-invalid-value",
+	[KIND_VLA_BOUND_NOT_POSITIVE]	= "vla-bound-not-positive",
+	[KIND_INVALID_BUILTIN]		= "invalid-builtin",
+	[KIND_BUILTIN_UNREACHABLE]	= "builtin-unreachable",
+	[KIND_MISSING_RETURN]		= "missing-return",
+};
+
+struct site {
+	const struct source_location *loc;	/* NULL while unclaimed */
+	u32 kind;
+	u64 count;
+};
+
+struct site_table {
+	u64 dropped;	/* hits that found the table full */
+	struct site sites[UBSAN_COUNT_SLOTS];
+};
+
+static struct site_table *table;
+static pid_t table_owner;
+
+static void __attribute__((constructor)) ubsan_count_init(void)
+{
+	table = mmap(NULL, sizeof(*table), PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (table == MAP_FAILED) {
+		perror("ubsan-count: mmap");
+		table = NULL;
+		return;
+	}
+	table_owner = getpid();
+}
+
+static inline u32 site_hash(const void *loc)
+{
+	uintptr_t bits = (uintptr_t)loc;
+
+	/* Site data is at least 8-byte aligned; mix the upper bits down. */
+	bits >>= 3;
+	bits ^= bits >> 15;
+	return (u32)(bits * 0x9E3779B1U) & (UBSAN_COUNT_SLOTS - 1);
+}
+
+static void count_site(const void *data, enum ubsan_kind kind)
+{
+	const struct source_location *loc = data;
+	u32 idx, probes;
+
+	if (!table)
+		return;
+
+	idx = site_hash(loc);
+	for (probes = 0; probes < UBSAN_COUNT_SLOTS; probes++) {
+		struct site *site = &table->sites[idx];
+		const struct source_location *seen;
+
+		seen = __atomic_load_n(&site->loc, __ATOMIC_ACQUIRE);
+		if (!seen) {
+			/* Try to claim the empty slot for this site. */
+			if (__atomic_compare_exchange_n(&site->loc, &seen, loc,
+							false, __ATOMIC_ACQ_REL,
+							__ATOMIC_ACQUIRE)) {
+				site->kind = kind;
+				seen = loc;
+			}
+		}
+		if (seen == loc) {
+			__atomic_fetch_add(&site->count, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		idx = (idx + 1) & (UBSAN_COUNT_SLOTS - 1);
+	}
+	__atomic_fetch_add(&table->dropped, 1, __ATOMIC_RELAXED);
+}
+
+static int compare_sites(const void *a, const void *b)
+{
+	const struct site *left = a, *right = b;
+	int cmp;
+
+	if (left->count != right->count)
+		return left->count < right->count ? 1 : -1;
+	cmp = strcmp(left->loc->file_name, right->loc->file_name);
+	if (cmp)
+		return cmp;
+	if (left->loc->line != right->loc->line)
+		return left->loc->line < right->loc->line ? -1 : 1;
+	return left->loc->column < right->loc->column ? -1 :
+	       left->loc->column > right->loc->column;
+}
+
+static void __attribute__((destructor)) ubsan_count_report(void)
+{
+	struct site *sites;
+	size_t i, used = 0;
+	u64 total = 0;
+
+	/* Only the process that created the table reports on it. */
+	if (!table || getpid() != table_owner)
+		return;
+
+	sites = calloc(UBSAN_COUNT_SLOTS, sizeof(*sites));
+	if (!sites)
+		return;
+	for (i = 0; i < UBSAN_COUNT_SLOTS; i++) {
+		struct site *site = &table->sites[i];
+
+		if (!__atomic_load_n(&site->loc, __ATOMIC_ACQUIRE))
+			continue;
+		sites[used] = *site;
+		sites[used].count = __atomic_load_n(&site->count, __ATOMIC_RELAXED);
+		total += sites[used].count;
+		used++;
+	}
+	qsort(sites, used, sizeof(*sites), compare_sites);
+
+	fprintf(stderr, "# ubsan-count: %llu hits across %zu sites", total, used);
+	if (table->dropped)
+		fprintf(stderr, " (%llu hits dropped: table full)", table->dropped);
+	fprintf(stderr, "\n");
+	for (i = 0; i < used; i++)
+		fprintf(stderr, "# %12llu  %-22s %s:%u:%u\n", sites[i].count,
+			kind_names[sites[i].kind], sites[i].loc->file_name,
+			sites[i].loc->line, sites[i].loc->column);
+	free(sites);
+}
+
+/*
+ * Both the recoverable and "_abort" flavors are provided so objects work
+ * regardless of -fsanitize-recover. Additional arguments (the operands,
+ * pointer values, etc) are not needed and are simply ignored.
+ */
+#define UBSAN_HANDLER(name, kind)					\
+	void __ubsan_handle_##name(void *data)				\
+	{								\
+		count_site(data, kind);					\
+	}								\
+	void __ubsan_handle_##name##_abort(void *data)			\
+	{								\
+		count_site(data, kind);					\
+		abort();						\
+	}
+
+/* These never return to the instrumented code. */
+#define UBSAN_FATAL_HANDLER(name, kind)					\
+	void __ubsan_handle_##name(void *data)				\
+	{								\
+		count_site(data, kind);					\
+		abort();						\
+	}
+
+UBSAN_HANDLER(out_of_bounds,		KIND_OUT_OF_BOUNDS)
+UBSAN_HANDLER(type_mismatch,		KIND_TYPE_MISMATCH)
+UBSAN_HANDLER(type_mismatch_v1,		KIND_TYPE_MISMATCH)
+UBSAN_HANDLER(add_overflow,		KIND_ADD_OVERFLOW)
+UBSAN_HANDLER(sub_overflow,		KIND_SUB_OVERFLOW)
+UBSAN_HANDLER(mul_overflow,		KIND_MUL_OVERFLOW)
+UBSAN_HANDLER(negate_overflow,		KIND_NEGATE_OVERFLOW)
+UBSAN_HANDLER(divrem_overflow,		KIND_DIVREM_OVERFLOW)
+UBSAN_HANDLER(pointer_overflow,		KIND_POINTER_OVERFLOW)
+UBSAN_HANDLER(implicit_conversion,	KIND_IMPLICIT_CONVERSION)
+UBSAN_HANDLER(shift_out_of_bounds,	KIND_SHIFT_OUT_OF_BOUNDS)
+UBSAN_HANDLER(load_invalid_value,	KIND_LOAD_INVALID_VALUE)
+UBSAN_HANDLER(vla_bound_not_positive,	KIND_VLA_BOUND_NOT_POSITIVE)
+UBSAN_HANDLER(invalid_builtin,		KIND_INVALID_BUILTIN)
+UBSAN_FATAL_HANDLER(builtin_unreachable, KIND_BUILTIN_UNREACHABLE)
+UBSAN_FATAL_HANDLER(missing_return,	KIND_MISSING_RETURN)
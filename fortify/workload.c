@@ -0,0 +1,561 @@
+/*
+ * Kernel-style hot paths reimplemented in userspace, to measure the
+ * end-to-end cost of the hardening flags instead of single checks in
+ * isolation. See Makefile for the flag groups each "workload-*" binary
+ * is built with, and "make bench" for the aggregate comparison.
+ *
+ * Every pattern folds its results into a checksum so the work cannot
+ * be optimized away, and so bench-report can verify that all of the
+ * configurations computed the same thing.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+typedef unsigned char	    u8;
+typedef unsigned short	   u16;
+typedef unsigned int	   u32;
+typedef unsigned long long u64;
+
+#define noinline __attribute__((__noinline__))
+
+#if __has_attribute(__counted_by__)
+# define __counted_by(member)	__attribute__((__counted_by__(member)))
+#else
+# define __counted_by(member)	/* __attribute__((__counted_by__(member))) */
+#endif
+
+#ifndef WORKLOAD_CONFIG
+# define WORKLOAD_CONFIG	"unknown"
+#endif
+
+#define min(a, b)	((a) < (b) ? (a) : (b))
+
+/* Used to stop optimizer from seeing constant expressions. */
+volatile int unconst = 0;
+
+/* Deterministic input generation (no overflow, so no sanitizer noise). */
+static u32 prng_state = 0x12345678;
+
+static inline u32 prng(void)
+{
+	u32 x = prng_state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return prng_state = x;
+}
+
+/* Fold a value into a checksum without relying on wrapping arithmetic. */
+static inline u64 fold(u64 sum, u64 value)
+{
+	sum ^= value;
+	return (sum << 7) | (sum >> 57);
+}
+
+static void *xmalloc(size_t bytes)
+{
+	void *p = malloc(bytes);
+
+	if (!p) {
+		perror("malloc");
+		exit(1);
+	}
+	return p;
+}
+
+/*
+ * Ring buffer with a flex-array payload (think tty buffers or
+ * perf/io_uring style rings): variable-length messages are copied in
+ * by the producer and copied back out by the consumer.
+ */
+#define RING_SLOTS	256
+#define RING_MSG_MAX	96
+
+struct ring_slot {
+	u16 len;
+	u8 data[RING_MSG_MAX];
+};
+
+struct ring {
+	u32 head;
+	u32 tail;
+	u32 used;
+	u32 mask;
+	u32 nr_slots;
+	struct ring_slot slots[] __counted_by(nr_slots);
+};
+
+static struct ring *ring_alloc(u32 nr_slots)
+{
+	struct ring *r;
+
+	r = xmalloc(sizeof(*r) + nr_slots * sizeof(*r->slots));
+	r->nr_slots = nr_slots;
+	r->mask = nr_slots - 1;
+	r->head = r->tail = r->used = 0;
+
+	return r;
+}
+
+static noinline bool ring_produce(struct ring *r, const u8 *src, size_t len)
+{
+	struct ring_slot *slot;
+
+	if (r->used == r->nr_slots || len > sizeof(slot->data))
+		return false;
+
+	slot = &r->slots[r->head];
+	memcpy(slot->data, src, len);
+	slot->len = len;
+	r->head = (r->head + 1) & r->mask;
+	r->used++;
+
+	return true;
+}
+
+static noinline size_t ring_consume(struct ring *r, u8 *dst, size_t size)
+{
+	struct ring_slot *slot;
+	size_t len;
+
+	if (r->used == 0)
+		return 0;
+
+	slot = &r->slots[r->tail];
+	len = min((size_t)slot->len, size);
+	memcpy(dst, slot->data, len);
+	r->tail = (r->tail + 1) & r->mask;
+	r->used--;
+
+	return len;
+}
+
+static u64 ring_sum;
+static struct ring *ring;
+static u8 ring_msg[RING_MSG_MAX];
+static u8 ring_out[RING_MSG_MAX];
+
+static void ring_setup(void)
+{
+	ring = ring_alloc(RING_SLOTS + unconst);
+	for (size_t i = 0; i < sizeof(ring_msg); i++)
+		ring_msg[i] = (u8)prng();
+}
+
+static inline void ring_op(unsigned long i)
+{
+	size_t len = 16 + (i % (RING_MSG_MAX - 16));
+
+	/* Keep the ring about half full, like a steady-state queue. */
+	ring_produce(ring, ring_msg, len);
+	if (ring->used > RING_SLOTS / 2) {
+		len = ring_consume(ring, ring_out, sizeof(ring_out));
+		ring_sum = fold(ring_sum, ring_out[len - 1]);
+	}
+}
+
+/*
+ * An skb-like buffer: a payload is put into the middle of the
+ * allocation, then protocol headers are pushed in front of it, and
+ * finally pulled back off again on the "receive" side.
+ */
+#define SKB_SIZE	2048
+#define SKB_HEADROOM	128
+
+struct sk_buff {
+	u32 data;	/* offset of first valid byte in head[] */
+	u32 len;	/* bytes of valid data */
+	u32 size;
+	u8 head[] __counted_by(size);
+};
+
+struct ethhdr {
+	u8 h_dest[6];
+	u8 h_source[6];
+	u16 h_proto;
+} __attribute__((packed));
+
+struct iphdr {
+	u8 ihl_version;
+	u8 tos;
+	u16 tot_len;
+	u16 id;
+	u16 frag_off;
+	u8 ttl;
+	u8 protocol;
+	u16 check;
+	u32 saddr;
+	u32 daddr;
+};
+
+struct udphdr {
+	u16 source;
+	u16 dest;
+	u16 len;
+	u16 check;
+};
+
+static struct sk_buff *alloc_skb(u32 size)
+{
+	struct sk_buff *skb;
+
+	skb = xmalloc(sizeof(*skb) + size * sizeof(*skb->head));
+	skb->size = size;
+	skb->data = skb->len = 0;
+
+	return skb;
+}
+
+static inline void skb_reserve(struct sk_buff *skb, u32 len)
+{
+	skb->data += len;
+}
+
+static noinline u8 *skb_put_data(struct sk_buff *skb, const void *src, u32 len)
+{
+	u8 *tail = &skb->head[skb->data + skb->len];
+
+	if (skb->data + skb->len + len > skb->size)
+		abort();
+	memcpy(tail, src, len);
+	skb->len += len;
+
+	return tail;
+}
+
+static noinline u8 *skb_push(struct sk_buff *skb, u32 len)
+{
+	if (len > skb->data)
+		abort();
+	skb->data -= len;
+	skb->len += len;
+
+	return &skb->head[skb->data];
+}
+
+static noinline u8 *skb_pull(struct sk_buff *skb, u32 len)
+{
+	if (len > skb->len)
+		return NULL;
+	skb->data += len;
+	skb->len -= len;
+
+	return &skb->head[skb->data];
+}
+
+static u64 skb_sum;
+static struct sk_buff *skb;
+static u8 skb_payload[512];
+
+static void skb_setup(void)
+{
+	skb = alloc_skb(SKB_SIZE + unconst);
+	for (size_t i = 0; i < sizeof(skb_payload); i++)
+		skb_payload[i] = (u8)prng();
+}
+
+static inline void skb_op(unsigned long i)
+{
+	struct ethhdr eth = { .h_proto = 0x0008 };
+	struct iphdr ip = { .ihl_version = 0x45, .ttl = 64, .protocol = 17 };
+	struct udphdr udp = { .source = 1234, .dest = 53 };
+	u32 len = 64 + (i % (sizeof(skb_payload) - 64));
+
+	/* Transmit side: build the packet from the inside out. */
+	skb->data = skb->len = 0;
+	skb_reserve(skb, SKB_HEADROOM);
+	skb_put_data(skb, skb_payload, len);
+	udp.len = len + sizeof(udp);
+	memcpy(skb_push(skb, sizeof(udp)), &udp, sizeof(udp));
+	ip.tot_len = udp.len + sizeof(ip);
+	memcpy(skb_push(skb, sizeof(ip)), &ip, sizeof(ip));
+	memcpy(skb_push(skb, sizeof(eth)), &eth, sizeof(eth));
+
+	/* Receive side: parse and strip each header. */
+	memcpy(&eth, &skb->head[skb->data], sizeof(eth));
+	memcpy(&ip, skb_pull(skb, sizeof(eth)), sizeof(ip));
+	memcpy(&udp, skb_pull(skb, sizeof(ip)), sizeof(udp));
+	skb_pull(skb, sizeof(udp));
+
+	skb_sum = fold(skb_sum, ip.tot_len ^ udp.len ^ skb->head[skb->data + skb->len - 1]);
+}
+
+/*
+ * A netlink-style TLV parser: walk a message of type/length/value
+ * records and copy each value into a fixed-layout result structure.
+ */
+enum tlv_type {
+	TLV_MTU = 1,
+	TLV_ADDR,
+	TLV_NAME,
+	TLV_FLAGS,
+	TLV_PAD,
+	TLV_MAX,
+};
+
+struct tlv_hdr {
+	u16 type;
+	u16 len;	/* length of value, excluding header */
+};
+
+struct tlv_msg {
+	u32 len;
+	u8 data[] __counted_by(len);
+};
+
+struct tlv_result {
+	u32 mtu;
+	u8 addr[16];
+	char name[32];
+	u32 flags;
+	u32 unknown;
+};
+
+static struct tlv_msg *tlv_build(u32 records)
+{
+	struct tlv_msg *msg;
+	u32 bytes = 0, max = records * (sizeof(struct tlv_hdr) + 40);
+
+	msg = xmalloc(sizeof(*msg) + max * sizeof(*msg->data));
+	msg->len = max;
+
+	for (u32 i = 0; i < records; i++) {
+		struct tlv_hdr hdr = { .type = 1 + prng() % (TLV_MAX - 1) };
+
+		switch (hdr.type) {
+		case TLV_MTU:
+		case TLV_FLAGS:
+			hdr.len = sizeof(u32);
+			break;
+		case TLV_ADDR:
+			hdr.len = (prng() & 1) ? 4 : 16;
+			break;
+		default:
+			hdr.len = 1 + prng() % 40;
+			break;
+		}
+		memcpy(&msg->data[bytes], &hdr, sizeof(hdr));
+		bytes += sizeof(hdr);
+		for (u16 j = 0; j < hdr.len; j++)
+			msg->data[bytes + j] = (u8)prng();
+		bytes += hdr.len;
+	}
+	msg->len = bytes;
+
+	return msg;
+}
+
+static noinline int tlv_parse(const struct tlv_msg *msg, struct tlv_result *res)
+{
+	u32 off = 0;
+	int count = 0;
+
+	while (off + sizeof(struct tlv_hdr) <= msg->len) {
+		struct tlv_hdr hdr;
+		const u8 *value;
+
+		memcpy(&hdr, &msg->data[off], sizeof(hdr));
+		off += sizeof(hdr);
+		if (hdr.len > msg->len - off)
+			return -1;
+		value = &msg->data[off];
+		off += hdr.len;
+
+		switch (hdr.type) {
+		case TLV_MTU:
+			memcpy(&res->mtu, value, min(sizeof(res->mtu), (size_t)hdr.len));
+			break;
+		case TLV_ADDR:
+			memcpy(res->addr, value, min(sizeof(res->addr), (size_t)hdr.len));
+			break;
+		case TLV_NAME:
+			memcpy(res->name, value, min(sizeof(res->name) - 1, (size_t)hdr.len));
+			res->name[min(sizeof(res->name) - 1, (size_t)hdr.len)] = '\0';
+			break;
+		case TLV_FLAGS:
+			memcpy(&res->flags, value, min(sizeof(res->flags), (size_t)hdr.len));
+			break;
+		case TLV_PAD:
+			break;
+		default:
+			res->unknown++;
+			break;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static u64 tlv_sum;
+static struct tlv_msg *tlv_msgs[16];
+
+static void tlv_setup(void)
+{
+	for (size_t i = 0; i < sizeof(tlv_msgs) / sizeof(*tlv_msgs); i++)
+		tlv_msgs[i] = tlv_build(8 + i);
+}
+
+static inline void tlv_op(unsigned long i)
+{
+	struct tlv_result res = { };
+	int count;
+
+	count = tlv_parse(tlv_msgs[i % (sizeof(tlv_msgs) / sizeof(*tlv_msgs))], &res);
+	tlv_sum = fold(tlv_sum, count ^ res.mtu ^ res.flags ^ res.addr[3] ^ res.name[0]);
+}
+
+/*
+ * A hash table whose buckets are __counted_by flexible arrays that
+ * get reallocated as they fill up, like many kernel lookup tables.
+ */
+#define GOLDEN_RATIO_32	0x61C88647
+#define HASH_BITS	10
+#define HASH_KEYS	4096
+
+struct hentry {
+	u32 key;
+	u32 value;
+};
+
+struct hbucket {
+	u16 used;
+	u16 cap;
+	struct hentry entries[] __counted_by(cap);
+};
+
+struct htable {
+	u32 bits;
+	u32 nr_buckets;
+	struct hbucket *buckets[] __counted_by(nr_buckets);
+};
+
+static inline u32 hash_32(u32 val, u32 bits)
+{
+	/* Written so the multiply cannot trip the overflow sanitizers. */
+	return (u32)((u64)val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+static struct hbucket *hbucket_alloc(u16 cap)
+{
+	struct hbucket *b;
+
+	b = xmalloc(sizeof(*b) + cap * sizeof(*b->entries));
+	b->cap = cap;
+	b->used = 0;
+
+	return b;
+}
+
+static struct htable *htable_alloc(u32 bits)
+{
+	struct htable *t;
+	u32 nr = 1U << bits;
+
+	t = xmalloc(sizeof(*t) + nr * sizeof(*t->buckets));
+	t->nr_buckets = nr;
+	t->bits = bits;
+	for (u32 i = 0; i < nr; i++)
+		t->buckets[i] = hbucket_alloc(2);
+
+	return t;
+}
+
+static noinline struct hentry *htable_lookup(struct htable *t, u32 key)
+{
+	struct hbucket *b = t->buckets[hash_32(key, t->bits)];
+
+	for (u16 i = 0; i < b->used; i++)
+		if (b->entries[i].key == key)
+			return &b->entries[i];
+	return NULL;
+}
+
+static noinline void htable_insert(struct htable *t, u32 key, u32 value)
+{
+	u32 idx = hash_32(key, t->bits);
+	struct hbucket *b = t->buckets[idx];
+
+	if (b->used == b->cap) {
+		struct hbucket *grown = hbucket_alloc(b->cap * 2);
+
+		memcpy(grown->entries, b->entries, b->used * sizeof(*b->entries));
+		grown->used = b->used;
+		free(b);
+		t->buckets[idx] = b = grown;
+	}
+	b->entries[b->used].key = key;
+	b->entries[b->used].value = value;
+	b->used++;
+}
+
+static u64 hash_sum;
+static struct htable *htable;
+static u32 hash_keys[HASH_KEYS];
+
+static void hash_setup(void)
+{
+	htable = htable_alloc(HASH_BITS + unconst);
+	for (u32 i = 0; i < HASH_KEYS; i++) {
+		hash_keys[i] = prng();
+		htable_insert(htable, hash_keys[i], i);
+	}
+}
+
+static inline void hash_op(unsigned long i)
+{
+	struct hentry *e;
+	/* Mix hits and misses. */
+	u32 key = (i & 3) ? hash_keys[i % HASH_KEYS] : (u32)i;
+
+	e = htable_lookup(htable, key);
+	if (e) {
+		e->value ^= 1;
+		hash_sum = fold(hash_sum, e->value);
+	}
+}
+
+struct pattern {
+	const char *name;
+	unsigned long iters;
+	void (*setup)(void);
+	u64 *sum;
+};
+
+#define PATTERN(op, count)	\
+	{ .name = #op, .iters = count, .setup = op ## _setup, .sum = &op ## _sum }
+
+static struct pattern patterns[] = {
+	PATTERN(ring, 2000000),
+	PATTERN(skb, 2000000),
+	PATTERN(tlv, 1000000),
+	PATTERN(hash, 4000000),
+};
+
+int main(void)
+{
+	double ns[sizeof(patterns) / sizeof(*patterns)];
+	size_t i;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(*patterns); i++)
+		patterns[i].setup();
+
+	/* Not a loop over function pointers: keep each body inlinable. */
+	ns[0] = BENCH_NS_PER_OP(bench_iters(patterns[0].iters), ring_op(__i));
+	ns[1] = BENCH_NS_PER_OP(bench_iters(patterns[1].iters), skb_op(__i));
+	ns[2] = BENCH_NS_PER_OP(bench_iters(patterns[2].iters), tlv_op(__i));
+	ns[3] = BENCH_NS_PER_OP(bench_iters(patterns[3].iters), hash_op(__i));
+
+	printf("# workload: %s\n", WORKLOAD_CONFIG);
+	for (i = 0; i < sizeof(patterns) / sizeof(*patterns); i++)
+		printf("%s\t%.2f\t%016llx\n", patterns[i].name, ns[i],
+		       *patterns[i].sum);
+
+	return 0;
+}